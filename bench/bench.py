@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+"""Runs the programs of bench/programs.txt in every mode of bc, checks their output and times them.
+
+    python3 bench/bench.py [--bc ./bc] [--modes jit,aot] [--repeat 5] [--out results.json]
+                           [--baseline old.json] [--threshold 0.10] [--filter math/] [--update-golden]
+
+Every program runs --repeat times per mode; the median and the minimum wall time are reported and written
+to --out as JSON. With --baseline the medians are compared with the ones of an earlier run: a program is
+a regression when its median grew by more than --threshold and by more than --min-delta seconds, the noise
+floor of the short ones. The exit status is 1 on a wrong output or a regression.
+"""
+import argparse
+import json
+import os
+import platform
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+TAPE = ['-M', '1000000']
+
+# mode -> flags of bc, the aot modes write an executable with -E and time it
+MODES = {
+    'jit': ['-J'],
+    'jit-O': ['-J', '-O'],
+    'aot': ['-E'],
+    'aot-O': ['-E', '-O'],
+    'interp': ['-I'],
+    'interp-O': ['-I', '-O'],
+}
+GOLDEN_MODE = 'interp-O'  # the plainest path, no pass and no code generation
+
+
+def load_programs(filter_text):
+    programs = []
+    with open(os.path.join(BENCH_DIR, 'programs.txt')) as manifest:
+        for line in manifest:
+            line = line.strip()
+            if not line or line.startswith('#'):
+                continue
+            fields = line.split(None, 1)
+            stdin = fields[1].replace('\\n', '\n') if len(fields) > 1 else ''
+            if filter_text in fields[0]:
+                programs.append((fields[0], stdin.encode()))
+    return programs
+
+
+def golden_path(program):
+    return os.path.join(BENCH_DIR, 'golden', os.path.splitext(program)[0] + '.out')
+
+
+def command(args, mode, program, workdir):
+    """returns the command running program in mode, building the executable first for the aot modes."""
+    source = os.path.join(BENCH_DIR, program)
+    if not mode.startswith('aot'):
+        return [args.bc] + MODES[mode] + TAPE + [source]
+    executable = os.path.join(workdir, program.replace('/', '_') + '-' + mode + '.x')
+    subprocess.run([args.bc] + MODES[mode] + TAPE + ['-N', executable, source],
+                   check=True, stdout=subprocess.DEVNULL, timeout=args.timeout)
+    return [os.path.splitext(executable)[0]]
+
+
+def run(cmd, stdin, timeout):
+    start = time.perf_counter()
+    result = subprocess.run(cmd, input=stdin, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, timeout=timeout)
+    return time.perf_counter() - start, result.stdout
+
+
+def compare(results, baseline_file, threshold, min_delta):
+    """prints the change of every median against the baseline, returns the number of regressions."""
+    with open(baseline_file) as f:
+        baseline = {(r['program'], r['mode']): r for r in json.load(f)['results']}
+    regressions = 0
+    print('\n%-26s %-9s %10s %10s %8s' % ('program', 'mode', 'baseline', 'median', 'change'))
+    for r in results:
+        old = baseline.get((r['program'], r['mode']))
+        if old is None or not r['ok']:
+            continue
+        change = (r['median'] - old['median']) / old['median'] if old['median'] > 0 else 0.0
+        flag = ''
+        if change > threshold and r['median'] - old['median'] > min_delta:
+            flag = '  REGRESSION'
+            regressions += 1
+        elif change < -threshold and old['median'] - r['median'] > min_delta:
+            flag = '  faster'
+        print('%-26s %-9s %10.4f %10.4f %+7.1f%%%s' % (r['program'], r['mode'], old['median'], r['median'], 100 * change, flag))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Benchmarks bc over the programs of bench/programs.txt.')
+    parser.add_argument('--bc', default=os.path.join(BENCH_DIR, '..', 'bc'), help='the compiler to run')
+    parser.add_argument('--modes', default=','.join(MODES), help='comma separated, among ' + ', '.join(MODES))
+    parser.add_argument('--repeat', type=int, default=5, help='runs per program and mode')
+    parser.add_argument('--timeout', type=float, default=120, help='seconds a single run may take')
+    parser.add_argument('--filter', default='', help='only the programs whose path contains this')
+    parser.add_argument('--out', help='file the results are written to as JSON')
+    parser.add_argument('--baseline', help='results of an earlier run to compare with')
+    parser.add_argument('--threshold', type=float, default=0.10, help='relative growth of a median that is a regression')
+    parser.add_argument('--min-delta', type=float, default=0.005, help='seconds a median must grow by to be a regression')
+    parser.add_argument('--update-golden', action='store_true', help='write the golden outputs with the ' + GOLDEN_MODE + ' mode and exit')
+    args = parser.parse_args()
+    args.bc = os.path.abspath(args.bc)
+    programs = load_programs(args.filter)
+
+    if args.update_golden:
+        for program, stdin in programs:
+            _, output = run(command(args, GOLDEN_MODE, program, None), stdin, args.timeout)
+            os.makedirs(os.path.dirname(golden_path(program)), exist_ok=True)
+            with open(golden_path(program), 'wb') as f:
+                f.write(output)
+            print('%-26s %8d bytes' % (program, len(output)))
+        return 0
+
+    modes = args.modes.split(',')
+    for mode in modes:
+        if mode not in MODES:
+            parser.error('unknown mode ' + mode)
+    results = []
+    failures = 0
+    print('%-26s %-9s %10s %10s  %s' % ('program', 'mode', 'median', 'min', 'output'))
+    with tempfile.TemporaryDirectory(prefix='bcbench-') as workdir:
+        for program, stdin in programs:
+            with open(golden_path(program), 'rb') as f:
+                golden = f.read()
+            for mode in modes:
+                times = []
+                ok = True
+                try:
+                    cmd = command(args, mode, program, workdir)
+                    for _ in range(args.repeat):
+                        elapsed, output = run(cmd, stdin, args.timeout)
+                        times.append(elapsed)
+                        ok = ok and output == golden
+                except (subprocess.TimeoutExpired, subprocess.CalledProcessError):
+                    ok = False
+                failures += not ok
+                median = statistics.median(times) if times else 0.0
+                minimum = min(times) if times else 0.0
+                results.append({'program': program, 'mode': mode, 'times': times, 'median': median, 'min': minimum, 'ok': ok})
+                print('%-26s %-9s %10.4f %10.4f  %s' % (program, mode, median, minimum, 'ok' if ok else 'WRONG'))
+                sys.stdout.flush()
+
+    if args.out:
+        with open(args.out, 'w') as f:
+            json.dump({'bc': args.bc, 'machine': platform.machine(), 'date': time.strftime('%Y-%m-%dT%H:%M:%S'),
+                       'repeat': args.repeat, 'results': results}, f, indent=1)
+    regressions = compare(results, args.baseline, args.threshold, args.min_delta) if args.baseline else 0
+    print('\n%d runs, %d wrong outputs, %d regressions' % (len(results), failures, regressions))
+    return 1 if failures or regressions else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+"""Measures how fast bc compiles, on large synthetic programs.
+
+    python3 bench/microbench.py [--bc ./bc] [--size 4] [--repeat 3] [--shapes runs,nested]
+
+Each program starts with a ',' and wraps its body in a loop: run with an empty stdin the cell is zero, the
+body never executes and only the compilation is measured. The phase times come from bc --stats-json:
+lexer and passes in the JIT run, then the JIT emission, the assembly text generation (file write included)
+and the ELF writer each in their own run. Throughput is reported over the source size, in MB/s, and over
+the instructions each phase gets: lexed ones for the lexer and the passes, the ones left by the passes for
+the back ends.
+"""
+import argparse
+import json
+import os
+import random
+import statistics
+import subprocess
+import sys
+import tempfile
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+
+
+def runs(size, r):
+    """long runs of + - < > and some output, what the lexer merges."""
+    parts = []
+    length = 0
+    while length < size:
+        part = r.choice('+-<>') * r.randint(1, 40) + ('.' if r.random() < 0.05 else '')
+        parts.append(part)
+        length += len(part)
+    return ''.join(parts)
+
+
+def nested(size, r):
+    """loops nested a thousand deep, over and over."""
+    unit = '[' * 1000 + '>+<-' + ']' * 1000
+    return unit * max(1, size // len(unit))
+
+
+def loops(size, r):
+    """millions of small loops, most of them patterns the passes rewrite."""
+    patterns = ['[-]', '[->+<]', '[-<<+>>]', '[>]', '[<<]', '[->++>+++<<]', '[>+<-.]', '[->[-]<]']
+    parts = []
+    length = 0
+    while length < size:
+        part = r.choice(patterns) + r.choice('><') * r.randint(1, 3)
+        parts.append(part)
+        length += len(part)
+    return ''.join(parts)
+
+
+def mixed(size, r):
+    """random code with loops up to 8 deep, like generated programs."""
+    out = []
+    depth = 0
+    length = 0
+    while length < size or depth > 0:
+        c = r.random()
+        if c < 0.08 and depth < 8 and length < size:
+            out.append('[')
+            depth += 1
+        elif c < 0.16 and depth > 0:
+            out.append(']')
+            depth -= 1
+        else:
+            out.append(r.choice('+-<>') * r.randint(1, 6) + ('.' if r.random() < 0.02 else ''))
+        length += len(out[-1])
+    return ''.join(out)
+
+
+SHAPES = {'runs': runs, 'nested': nested, 'loops': loops, 'mixed': mixed}
+
+# run -> (flags of bc, phases timed in it)
+RUNS = {
+    'jit': (['-J'], ['lexer', 'passes', 'jit compile']),
+    'assembly': ([], ['assembly']),
+    'elf': (['-E'], ['elf']),
+}
+
+
+def stats(args, flags, source):
+    result = subprocess.run([args.bc, '--stats-json'] + flags + [source], stdin=subprocess.DEVNULL,
+                            stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, check=True, timeout=args.timeout)
+    report = json.loads(result.stderr.decode().strip().splitlines()[-1])
+    report['phases'] = {phase['name']: phase['ms'] / 1000 for phase in report['phases_ms']}
+    return report
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Times the lexer, the passes and the back ends of bc on synthetic programs.')
+    parser.add_argument('--bc', default=os.path.join(BENCH_DIR, '..', 'bc'), help='the compiler to run')
+    parser.add_argument('--size', type=float, default=4, help='megabytes of source per program')
+    parser.add_argument('--repeat', type=int, default=3, help='runs per program, the median is reported')
+    parser.add_argument('--shapes', default=','.join(SHAPES), help='comma separated, among ' + ', '.join(SHAPES))
+    parser.add_argument('--timeout', type=float, default=300, help='seconds a single run may take')
+    parser.add_argument('--out', help='file the results are written to as JSON')
+    args = parser.parse_args()
+    args.bc = os.path.abspath(args.bc)
+    size = int(args.size * 1024 * 1024)
+
+    results = []
+    print('%-8s %-12s %10s %10s %12s %14s' % ('program', 'phase', 'MB', 'seconds', 'MB/s', 'instructions/s'))
+    with tempfile.TemporaryDirectory(prefix='bcmicro-') as workdir:
+        for shape in args.shapes.split(','):
+            if shape not in SHAPES:
+                parser.error('unknown shape ' + shape)
+            source = os.path.join(workdir, shape + '.bf')
+            with open(source, 'w') as f:
+                f.write(',[' + SHAPES[shape](size, random.Random(shape)) + ']')
+            megabytes = os.path.getsize(source) / (1024 * 1024)
+            for run, (flags, phases) in RUNS.items():
+                reports = [stats(args, flags, source) for _ in range(args.repeat)]
+                for phase in phases:
+                    seconds = statistics.median(report['phases'][phase] for report in reports)
+                    instructions = reports[0]['lexed'] if phase in ('lexer', 'passes') else reports[0]['instructions']
+                    results.append({'program': shape, 'phase': phase, 'megabytes': megabytes, 'seconds': seconds,
+                                    'instructions': instructions, 'code_bytes': reports[0]['code_bytes']})
+                    print('%-8s %-12s %10.2f %10.4f %12.1f %14.3g' % (shape, phase, megabytes, seconds,
+                          megabytes / seconds if seconds else 0, instructions / seconds if seconds else 0))
+                    sys.stdout.flush()
+
+    if args.out:
+        with open(args.out, 'w') as f:
+            json.dump({'bc': args.bc, 'size': size, 'repeat': args.repeat, 'results': results}, f, indent=1)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
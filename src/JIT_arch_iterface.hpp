@@ -6,7 +6,7 @@
 #include <map>
 #include <sys/mman.h>
 
-enum InstructionType{
+enum InstructionType : uint8_t{
   ADD     = '+',
   SUB     = '-',
   INC     = '>',    
@@ -16,7 +16,9 @@ enum InstructionType{
   BNEQ    = ']',  
   BEQZ    = '[',  
   MOV0    = '0',
-  ADDTO   = 'A',
+  MUL     = 'M',  // cell[p+extra] += arg * cell[p]
+  SCAN    = 'S',  // move by extra cells (signed) until a zero cell
+  BREAK   = '#',  // breakpoint, only lexed with -D
   UNKNOWN = '?' // Unknown instruction 
 };
 typedef enum InstructionType InstructionType;
@@ -28,6 +30,9 @@ typedef enum InstructionType InstructionType;
 typedef struct JIT_init{
   std::map<uint8_t, uint32_t> instructions_size;
   uint8_t branch_address_size;                        // Size of the branch address in bytes
+  uint8_t short_branch_address_size = 0;              // Size of the branch address of short branches, 0 if the architecture has none
+  uint16_t elf_machine = 0;                           // EM_* value of the generated code, 0 if it cannot be written as an ELF executable
+  uint8_t cache_registers = 0;                        // Cells the architecture can keep in registers inside a loop, 0 disables the cache
 }JIT_init_t;
 
 
@@ -42,6 +47,26 @@ typedef struct{
   size_t memory_size;
 }jit_code_t;
 
+#define JIT_IO_BUFFER_SIZE 65536 // Size of each stdin/stdout buffer used by the JIT code
+#define JIT_TAPE_GUARD 64 // Zeroed bytes before and after the tape, vectorized scans may read past the last cell
+
+/**
+ * @brief this structure holds the I/O buffers of a JIT program.
+ * It is passed to the JIT code as second argument, the output is collected in out and written when the buffer is full,
+ * before reading from stdin and at the end of the program; the input is read ahead into in.
+ * A whole program starts with empty buffers, the cursors are only used by fragments, that share the buffers with the interpreter.
+ */
+typedef struct{
+  uint8_t out[JIT_IO_BUFFER_SIZE];
+  uint8_t in[JIT_IO_BUFFER_SIZE];
+  uint64_t out_pos;  // bytes of out not written yet
+  uint64_t in_pos;   // next byte of in to read
+  uint64_t in_end;   // bytes of in read from stdin
+  uint32_t break_pc; // instruction a breakpoint stopped the program at, JIT_NO_BREAK if it ran to the end
+}jit_io_t;
+
+#define JIT_NO_BREAK UINT32_MAX
+
 /**
  * @brief this function checks if the JIT code buffer has enough space for the given size.
  * if not, it prints an error message and returns false.
@@ -111,6 +136,7 @@ class JITInterface {
    * @brief Virtual method to start a JIT program.
    * This function takes a pointer to a JIT code structure and initializes the program start.
    * It's main function is to prepare the register that will handle the memory pointer.
+   * The generated code is called as void(void *memory, jit_io_t *io), so it also has to prepare the I/O buffers.
    * @param jit Pointer to the JIT code structure.  
   */
   virtual inline void proStart(jit_code_t *jit)=0;
@@ -118,44 +144,48 @@ class JITInterface {
   /**
    * @brief Virtual method to end a JIT program.
    * This function takes a pointer to a JIT code structure and finalizes the program end.
-   * It typically includes the system call to exit the program.
+   * It typically flushes the output buffer and returns to the caller.
    * @param jit Pointer to the JIT code structure.
   */
   virtual inline void proEnd(jit_code_t *jit)=0;
   
   /**
-   * @brief Virtual method to increment the current cell value.
-   * This function takes a pointer to a JIT code structure and increment the current cell to the value of count.
+   * @brief Virtual method to increment the value of a cell.
+   * This function takes a pointer to a JIT code structure and increment the cell at offset from the current one by the value of count.
    * In brainfuck each cell can hold up to 255, so the count is a uint8_t and the value is supposed to wrap.
    * @param jit Pointer to the JIT code structure.
-   * @param count The value to add to the current cell.
+   * @param count The value to add to the cell.
+   * @param offset The signed distance in cells from the current cell, 0 when optimisations are turned off.
    */
-  virtual inline void add(jit_code_t *jit,uint8_t count)=0;
+  virtual inline void add(jit_code_t *jit,uint8_t count,int32_t offset)=0;
     
   /**
-   * @brief Virtual method to decrement the current cell value.
-   * This function takes a pointer to a JIT code structure and decrement the current cell to the value of count.
+   * @brief Virtual method to decrement the value of a cell.
+   * This function takes a pointer to a JIT code structure and decrement the cell at offset from the current one by the value of count.
    * In brainfuck each cell can hold up to 255, so the count is a uint8_t and the value is supposed to wrap.
    * @param jit Pointer to the JIT code structure.
-   * @param count The value to subtract to the current cell.
+   * @param count The value to subtract to the cell.
+   * @param offset The signed distance in cells from the current cell, 0 when optimisations are turned off.
    */
-  virtual inline void sub(jit_code_t*jit,uint8_t count)=0;
+  virtual inline void sub(jit_code_t*jit,uint8_t count,int32_t offset)=0;
     
   /**
-   * @brief Virtual method to print the current cell as ASCII char.
-   * This function takes a pointer to a JIT code structure and prints the current cell value.
-   * It typically includes the system call to write to stdout.
+   * @brief Virtual method to print a cell as ASCII char.
+   * This function takes a pointer to a JIT code structure and prints the value of the cell at offset from the current one.
+   * It typically appends the value to the output buffer, writing it to stdout only when it is full.
    * @param jit Pointer to the JIT code structure.
+   * @param offset The signed distance in cells from the current cell.
    */
-  virtual inline void output(jit_code_t *jit)=0;
+  virtual inline void output(jit_code_t *jit,int32_t offset)=0;
     
   /**
-   * @brief Virtual method to take from input a value and store it in the current cell.
-   * This function takes a pointer to a JIT code structure and take a value from input then stores it in the current cell value.
-   * It typically includes the system call to read from stdout.
+   * @brief Virtual method to take from input a value and store it in a cell.
+   * This function takes a pointer to a JIT code structure and take a value from input then stores it in the cell at offset from the current one.
+   * It typically reads from the input buffer, refilling it from stdin only when it is empty.
    * @param jit Pointer to the JIT code structure.
+   * @param offset The signed distance in cells from the current cell.
    */
-  virtual inline void input(jit_code_t *jit)=0;
+  virtual inline void input(jit_code_t *jit,int32_t offset)=0;
     
   /**
    * @brief Virtual method to increment the current pointer.
@@ -181,39 +211,166 @@ class JITInterface {
    * It typically includes the logic to compare the current cell value with zero and jump to the specified instruction.
    * @param jit Pointer to the JIT code structure.
    * @param jump The address to jump to if the current cell is not equal to zero.
+   * @param short_jump Use the short_branch_address_size encoding, the jit compiler checks the distance fits and emits the program again otherwise.
    * @note The logic used into the jit compiler is to assign the jump address of the bneq instruction during the compilation of the beqz instruction.
    */
-  virtual inline void bneq(jit_code_t *jit, uint32_t jump)=0;
+  virtual inline void bneq(jit_code_t *jit, uint32_t jump, bool short_jump)=0;
     
   /**
-   * @brief Virtual method to branch if the current cell is equal to zero.
-   * This function takes a pointer to a JIT code structure and branches to the instruction at jump if the current cell is equal to zero.
+   * @brief Virtual method to branch if a cell is equal to zero.
+   * This function takes a pointer to a JIT code structure and branches to the instruction at jump if the cell at offset from the current one is equal to zero.
    * @param jit Pointer to the JIT code structure.
-   * @param jump The address to jump to if the current cell is not equal to zero.
+   * @param offset The signed distance in cells from the current cell, always 0 for loops, the guard of a mul sequence may use another one.
+   * @param short_jump Use the short_branch_address_size encoding, the jump address is then patched with that many bytes.
    * @note The logic used into the jit compiler is to assigne the jump address of the beqz instruction during the compilation of the bneq instruction, because during the beqz instruction the jump address is not known yet.
+   * The jump address always is the last field of the instruction, relative to its end.
    */
-  virtual inline void beqz(jit_code_t*jit)=0;
+  virtual inline void beqz(jit_code_t*jit,int32_t offset,bool short_jump)=0;
 
   //OPTIMISATIONS
   //  no need to implement these functions if optimisations is turned off
 
 
   /**
-   * @brief Virtual method to move the current cell value to zero.
-   * This function takes a pointer to a JIT code structure and sets the current cell value to zero.
+   * @brief Virtual method to move a cell value to zero.
+   * This function takes a pointer to a JIT code structure and sets the value of the cell at offset from the current one to zero.
    * @param jit Pointer to the JIT code structure.
+   * @param offset The signed distance in cells from the current cell.
    * @note this is used to optimize [+] and [-] loops
    */
-  virtual inline void mov0(jit_code_t *jit)=0;
+  virtual inline void mov0(jit_code_t *jit,int32_t offset)=0;
+
+  /**
+   * @brief Virtual method to add a multiple of a cell value to another cell.
+   * This function takes a pointer to a JIT code structure and adds factor times the value of the source cell to the target cell.
+   * The source cell is left untouched, a sequence of mul is always closed by a mov0 of the source cell.
+   * @param jit Pointer to the JIT code structure.
+   * @param source The signed distance in cells from the current cell to the source cell.
+   * @param target The signed distance in cells from the current cell to the target cell.
+   * @param factor The multiplier, wraps like the cells so 255 subtracts the source cell value.
+   * @note this is used to optimize copy and multiply loops like [->+>+++<<] or [-<->]
+   */
+  virtual inline void mul(jit_code_t *jit, int32_t source, int32_t target, uint8_t factor)=0;
+
+  /**
+   * @brief Virtual method to move the current pointer by stride cells until it reaches a zero cell.
+   * This function takes a pointer to a JIT code structure and emits the search for the first zero cell at current + k*stride, k >= 0.
+   * The tape is surrounded by JIT_TAPE_GUARD zeroed bytes, so an implementation may read up to that many bytes past the cell it checks.
+   * @param jit Pointer to the JIT code structure.
+   * @param stride The signed distance between two checked cells, positive moves right.
+   * @note this is used to optimize [>], [<] and [>>>>>>>>>] loops
+   */
+  virtual inline void scan(jit_code_t *jit, int32_t stride)=0;
+
+  /**
+   * @brief Virtual method to keep some cells in registers for the body of an innermost loop.
+   * This function takes a pointer to a JIT code structure and loads the cells at the given offsets into registers,
+   * from then on every instruction working on one of these cells uses the register instead of the tape.
+   * It is called right after the beqz of a loop with no pointer movement, so the tape pointer does not change until cacheStore.
+   * The implementation must write the registers back around input and output, as the I/O code works on the tape.
+   * @param jit Pointer to the JIT code structure.
+   * @param offsets The signed distances of the cells to keep, the first one is always the loop cell (0).
+   * @param count The number of offsets, never more than cache_registers.
+   * @note bneq jumps back after the loads, so they run once per loop instead of once per iteration.
+   */
+  virtual inline void cacheLoad(jit_code_t *jit, const int32_t *offsets, uint8_t count)=0;
+
+  /**
+   * @brief Virtual method to write the cached cells back to the tape at the exit of a loop.
+   * This function takes a pointer to a JIT code structure, stores every register loaded by cacheLoad and drops the cache.
+   * @param jit Pointer to the JIT code structure.
+   */
+  virtual inline void cacheStore(jit_code_t *jit)=0;
+
+  /**
+   * @brief Virtual method to emit the entry point of an executable.
+   * This function takes a pointer to a JIT code structure, the program must start at offset 0 of the buffer.
+   * The entry point first writes the output evaluated at compile time to stdout, if any, then calls the program
+   * like the JIT does, with the tape pointer and the I/O buffers, then exits with status 0.
+   * Only needed by architectures setting elf_machine.
+   * @param jit Pointer to the JIT code structure.
+   * @param tape The address of the cell the program starts on, the tape is guarded by JIT_TAPE_GUARD zeroed bytes on both sides.
+   * @param io The address of the jit_io_t buffers.
+   * @param output The address of the output evaluated at compile time.
+   * @param output_size Its size in bytes, 0 when there is none.
+   */
+  virtual inline void elfEntry(jit_code_t *jit, uint32_t tape, uint32_t io, uint32_t output, uint32_t output_size)=0;
+
+  /**
+   * @brief Virtual method to emit a breakpoint, it stops the program before the instruction at pc.
+   * The code stores pc in the break_pc of jit_io_t, flushes the output and returns the tape pointer like fragmentEnd,
+   * so the caller of the program gets the live tape, pointer and input buffer to hand to the debugger.
+   * @param jit Pointer to the JIT code structure.
+   * @param pc The index of the instruction the program stops at.
+   */
+  virtual inline void breakpoint(jit_code_t *jit, uint32_t pc)=0;
+
+  /**
+   * @brief Virtual method to increment a 64 bit counter in memory, used by --profile on loop entries and iterations.
+   * It must leave the tape, the cells cached in registers and the I/O cursors untouched.
+   * @param jit Pointer to the JIT code structure.
+   * @param address The address of the counter.
+   */
+  virtual inline void counter(jit_code_t *jit, uint64_t *address)=0;
+
+  /**
+   * @brief Virtual method to pad the code with instructions doing nothing until its size is a multiple of boundary.
+   * Used on the head of the hot loops of --profile-use, so the body starts on a fetch block.
+   * @param jit Pointer to the JIT code structure.
+   * @param boundary A power of two, at most 64.
+   */
+  virtual inline void align(jit_code_t *jit, uint8_t boundary)=0;
+
+  //FRAGMENTS
+  //  used by the tiered execution to compile single loops, the code buffer then holds many of them
+
+  /**
+   * @brief Virtual method to emit the routines shared by the fragments of a code buffer, such as the I/O ones.
+   * It is called once, before the first fragment of a buffer.
+   * @param jit Pointer to the JIT code structure.
+   */
+  virtual inline void runtime(jit_code_t *jit)=0;
+
+  /**
+   * @brief Virtual method to start a fragment, a piece of program called as void*(void *pointer, jit_io_t *io).
+   * Unlike proStart it takes the current tape pointer and resumes the I/O cursors stored in io.
+   * @param jit Pointer to the JIT code structure.
+   */
+  virtual inline void fragmentStart(jit_code_t *jit)=0;
+
+  /**
+   * @brief Virtual method to end a fragment.
+   * It stores the I/O cursors back in io without flushing the output and returns the tape pointer.
+   * @param jit Pointer to the JIT code structure.
+   */
+  virtual inline void fragmentEnd(jit_code_t *jit)=0;
+
+  //LAZY
+  //  used by the lazy JIT, top level loops are emitted as stubs and compiled the first time they are reached
+
+  /**
+   * @brief Virtual method to emit the routine called by the stubs.
+   * It preserves the state of the program, calls resolver(state, return address of the stub), which compiles the loop
+   * and returns its address, then drops the return address and jumps to the loop. Emitted once, before the program.
+   * @param jit Pointer to the JIT code structure.
+   * @param state First argument of resolver.
+   * @param resolver Function compiling the loop of a stub.
+   */
+  virtual inline void lazyRuntime(jit_code_t *jit, const void *state, const void *resolver)=0;
+
+  /**
+   * @brief Virtual method to emit the stub of a loop, a call to the lazyRuntime routine.
+   * It must be as long as the jump emitted by jump, which later overwrites it.
+   * @param jit Pointer to the JIT code structure.
+   */
+  virtual inline void lazyStub(jit_code_t *jit)=0;
 
   /**
-   * @brief Virtual method to add the current cell value to the n-th previus cell.
-   * This function takes a pointer to a JIT code structure and adds the current cell value to the next cell.
+   * @brief Virtual method to emit an unconditional jump to target, anywhere in the buffer.
    * @param jit Pointer to the JIT code structure.
-   * @param count The value to add to the next cell.
-   * @note this is used to optimize [->..+<..] loops
+   * @param target Offset of the destination in the code buffer.
    */
-  virtual inline void addto(jit_code_t *jit, uint8_t count)=0;
+  virtual inline void jump(jit_code_t *jit, uint32_t target)=0;
 };
 
 #endif
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <sstream>
 #include <iomanip>
 
+#define ASSEMBLY_WRITE_BUFFER (1 << 20) // Bytes of assembly collected before they are written to the output file
 
 /**
  * @file Architecture_Interface.h
@@ -36,53 +37,92 @@ class ArchitectureInterface {
     */
     virtual std::string proEnd()=0;
     /**
-     * @brief virtual function add one to the current pointer value.
+     * @brief virtual function to add count to a cell.
      * this function returns a string that represents the addition operation in the specific architecture.
+     * cells are bytes, the value wraps around.
+     * @param offset signed distance in cells from the current pointer, 0 when optimisations are turned off.
      * @return std::string representing the addition operation.
     */
-    virtual std::string add(uint8_t count)=0;
+    virtual std::string add(uint8_t count, int32_t offset)=0;
     /**
-     * @brief virtual function to subtract one from the current pointer value.
+     * @brief virtual function to subtract count from a cell.
      * this function returns a string that represents the subtraction operation in the specific architecture.
+     * @param offset signed distance in cells from the current pointer, 0 when optimisations are turned off.
      * @return std::string representing the subtraction operation.
     */
-    virtual std::string sub(uint8_t count)=0;
+    virtual std::string sub(uint8_t count, int32_t offset)=0;
     /**
-     * @brief virtual function to print the current pointer value.
+     * @brief virtual function to print a cell.
      * this function returns a string that represents the print operation in the specific architecture.
+     * @param offset signed distance in cells from the current pointer.
      * @return std::string representing the print operation.
     */
-    virtual std::string output()=0;
+    virtual std::string output(int32_t offset)=0;
     /**
-     * @brief virtual function to read input into the current pointer value.
+     * @brief virtual function to read input into a cell, the cell is left unchanged at the end of the input.
      * this function returns a string that represents the input operation in the specific architecture.
+     * @param offset signed distance in cells from the current pointer.
      * @return std::string representing the input operation.
     */
-    virtual std::string input()=0;
+    virtual std::string input(int32_t offset)=0;
     /**
      * @brief virtual function to increment the current pointer.
      * this function returns a string that represents the increment pointer operation in the specific architecture.
      * @return std::string representing the increment pointer operation.
     */
-    virtual std::string inc(uint8_t count)=0;
+    virtual std::string inc(uint32_t count)=0;
     /**
      * @brief virtual function to decrement the current pointer.
      * this function returns a string that represents the decrement pointer operation in the specific architecture.
      * @return std::string representing the decrement pointer operation.
     */
-    virtual std::string dec(uint8_t count)=0;
+    virtual std::string dec(uint32_t count)=0;
+    /**
+     * @brief virtual function to end a cycle.
+     * this function returns a string that represents the branch operation to lable_<loop> if the current cell is not equal to zero.
+     * the string starts with the label lable_<loop>_end, the beqz of the cycle jumps there.
+     * @param loop the position of the beqz of the cycle, known before the end of the cycle is so the code can be written as it goes.
+     * @return std::string representing the end of a cycle.
+    */
+    virtual std::string bneq(uint64_t loop)=0;
     /**
      * @brief virtual function to start a cycle.
-     * this function returns a string that represents the branch operation if the current cell is equal to zero.
+     * this function returns a string that represents the branch operation to lable_<pc>_end if a cell is equal to zero.
+     * the string ends with the label lable_<pc>, the bneq of the cycle jumps back there.
+     * @param offset signed distance in cells from the current pointer, 0 for cycles, the guard of a mul sequence may use another one.
      * @return std::string representing the start of a cycle.
     */
-    virtual std::string bneq(uint64_t pc, uint64_t jump)=0;
+    virtual std::string beqz(uint64_t pc, int32_t offset)=0;
     /**
-     * @brief virtual function to end a cycle.
-     * this function returns a string that represents the branch operation if the current cell is not equal to zero.
-     * @return std::string representing the end of a cycle.
+     * @brief virtual function to place the label lable_<pc>_end.
+     * used to close the guard of a mul sequence started by the beqz at pc, that jumps past it.
+     * @return std::string representing the label.
+    */
+    virtual std::string label(uint64_t pc)=0;
+
+    //OPTIMISATIONS
+    //  these instructions are only produced by the compiler passes
+
+    /**
+     * @brief virtual function to set a cell to zero, replaces [-] and [+].
+     * @param offset signed distance in cells from the current pointer.
+     * @return std::string representing the operation.
+    */
+    virtual std::string mov0(int32_t offset)=0;
+    /**
+     * @brief virtual function to add factor times the source cell to the target cell, the source is left untouched.
+     * a sequence of mul replaces a multiply loop like [->+>+++<<], it is always guarded by a beqz on the source and closed by a mov0 of it.
+     * @param factor the multiplier, wraps like the cells so 255 subtracts the source cell.
+     * @return std::string representing the operation.
+    */
+    virtual std::string mul(int32_t source, int32_t target, uint8_t factor)=0;
+    /**
+     * @brief virtual function to move the current pointer by stride cells until it reaches a zero cell, replaces [>] and [<<<].
+     * @param pc the position of the instruction, to make its labels unique.
+     * @param stride signed distance between two checked cells, positive moves right.
+     * @return std::string representing the operation.
     */
-    virtual std::string beqz(uint64_t pc, uint64_t jump)=0;
+    virtual std::string scan(uint64_t pc, int32_t stride)=0;
     /**
      * @brief Converts a 64-bit unsigned integer to a hexadecimal string representation.
      * 
@@ -14,235 +14,410 @@
 #include <chrono>
 #include <fstream>
 #include <streambuf>
+#include <algorithm>
 #include "lexer.hpp"
+#include "passes.hpp"
+#include "elf.hpp"
+#include "interpreter.hpp"
+#include "jit.hpp"
+#include "trace.hpp"
+#include "profile.hpp"
+#include "stats.hpp"
+#include "counters.hpp"
+#include "perfmap.hpp"
+#include "evaluator.hpp"
 
-#define OPT_MOV0 2 //the size of the move 0 instruction [+] or [-]
-#define OPT_ADDTO 5 // the size of the add to instruction [-<+>] || [->+<]
-#define INT32_S 4
+/**
+ * @brief collects the assembly and writes it to the output file every ASSEMBLY_WRITE_BUFFER bytes.
+ */
+typedef struct{
+  FILE *file;
+  std::string buffer;
+  bool echo; // --verbose prints the program as it is written
+}assembly_writer_t;
 
-void compiler(instructions_list instructions,CompilerOptions options){
-  ArchitectureInterface *arch = getCompArch(options.target_arch);
-  verbose(options, "Target architecture: " );
+static void assemblyFlush(assembly_writer_t &writer) {
+  fwrite(writer.buffer.data(), 1, writer.buffer.size(), writer.file);
+  if(writer.echo)
+    std::cout << writer.buffer;
+  writer.buffer.clear();
+}
+
+static void assemblyWrite(assembly_writer_t &writer, const std::string &text) {
+  writer.buffer += text;
+  if(writer.buffer.size() >= ASSEMBLY_WRITE_BUFFER)
+    assemblyFlush(writer);
+}
 
-  uint64_t pc =0;
-  std::string program ="";
-  program+= arch->proStart(options.max_memory);
-  for(Instruction instruction : instructions){
+/**
+ * @brief writes the assembly of a piece of the program, pc is the position of its first instruction in the whole program.
+ * loops holds the beqz of every cycle still open, the end of a cycle can be in a later piece.
+ */
+static void assemblePiece(ArchitectureInterface *arch, assembly_writer_t &writer, const instructions_list &instructions,
+                          uint64_t &pc, std::vector<uint64_t> &loops) {
+  uint64_t guard = 0; // beqz of the multiply loop being written
+  for(size_t k=0;k<instructions.size();k++,pc++){
+    const Instruction &instruction = instructions[k];
     switch(instruction.type){
       case InstructionType::ADD:
-        program += arch->add(instruction.extra);
+        assemblyWrite(writer, arch->add(instruction.extra,instruction.offset));
       break;
       case InstructionType::SUB:
-        program += arch->sub(instruction.extra);
+        assemblyWrite(writer, arch->sub(instruction.extra,instruction.offset));
       break;
       case InstructionType::INC:
-        program += arch->inc(instruction.extra);
+        assemblyWrite(writer, arch->inc(instruction.extra));
       break;
       case InstructionType::DEC:
-        program += arch->dec(instruction.extra);
+        assemblyWrite(writer, arch->dec(instruction.extra));
       break;
       case InstructionType::INPUT:
-        program += arch->input();
+        assemblyWrite(writer, arch->input(instruction.offset));
       break;
       case InstructionType::OUTPUT:
-        program += arch->output();
+        assemblyWrite(writer, arch->output(instruction.offset));
       break;
       case InstructionType::BEQZ:
-        program += arch->beqz(pc,instruction.extra);
+        assemblyWrite(writer, arch->beqz(pc,0));
+        loops.push_back(pc);
       break;
       case InstructionType::BNEQ:
-        program += arch->bneq(pc,instruction.extra);
-      break; 
+        assemblyWrite(writer, arch->bneq(loops.back()));
+        loops.pop_back();
+      break;
+      case InstructionType::MOV0:
+        assemblyWrite(writer, arch->mov0(instruction.offset));
+        if(k>0 && instructions[k-1].type==InstructionType::MUL)
+          assemblyWrite(writer, arch->label(guard)); // end of the guard of the multiply loop
+      break;
+      case InstructionType::MUL:
+        if(k==0 || instructions[k-1].type!=InstructionType::MUL){
+          // the loop body only ran when the cell was not zero, targets can be out of the tape otherwise
+          guard = pc;
+          assemblyWrite(writer, arch->beqz(pc,instruction.offset));
+        }
+        assemblyWrite(writer, arch->mul(instruction.offset,instruction.offset+static_cast<int32_t>(instruction.extra),instruction.arg));
+      break;
+      case InstructionType::SCAN:
+        assemblyWrite(writer, arch->scan(pc,static_cast<int32_t>(instruction.extra)));
+      break;
+      default:
+      break;
     }
-    pc++;
   }
-  program += arch->proEnd();
+}
+
+/**
+ * @brief compiles the source to assembly as it is lexed: a window of source is lexed, optimized and written out before
+ * the next one is read. The memory used depends on the nesting depth and on the longest loop the passes could rewrite,
+ * not on the program size.
+ */
+void compiler(CompilerOptions options,std::map<InstructionType,uint32_t> &instructions_map){
+  ArchitectureInterface *arch = getCompArch(options.target_arch);
+  verbose(options, "Target architecture: " );
+
+  assembly_writer_t writer;
+  writer.file = fileWrite(options.output_file_name.c_str());
+  writer.echo = options.verbose;
+  lexer_stream_t stream;
+  lexerOpen(stream, options);
+  instructions_list lexed, piece, scratch;
+  std::vector<uint64_t> loops;
+  pass_cut_t cutter;
+  uint64_t pc = 0;
+  double lexing = 0, optimizing = 0;
+  stats_clock_t begin = statsStart();
+  assemblyWrite(writer, arch->proStart(options.max_memory));
+  bool more = true;
+  while(more){
+    stats_clock_t start = statsStart();
+    more = lexerNext(stream, lexed, options);
+    lexing += statsElapsed(start);
+    if(!stream.error.empty()){
+      fclose(writer.file);
+      remove(options.output_file_name.c_str());
+      std::cerr << stream.error << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    // the passes only see whole pieces, the code after the cut waits for the next window
+    bool flush = false;
+    size_t cut = more ? passesCut(cutter, lexed, LEXER_WINDOW, flush) : lexed.size();
+    piece.assign(lexed.begin(), lexed.begin() + cut);
+    lexed.erase(lexed.begin(), lexed.begin() + cut);
+    if(options.optimize){
+      start = statsStart();
+      runPassesPiece(piece, scratch, options, flush);
+      optimizing += statsElapsed(start);
+    }
+    assemblePiece(arch, writer, piece, pc, loops);
+  }
+  assemblyWrite(writer, arch->proEnd());
+  assemblyFlush(writer);
+  lexerClose(stream, instructions_map);
+  delete arch; // Clean up architecture object
+  if(ferror(writer.file) | fclose(writer.file)){
+    std::cerr << "Error: Could not write the output file '" << options.output_file_name << "'." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  stats.phases.push_back({"lexer", lexing});
+  if(options.optimize)
+    stats.phases.push_back({"passes", optimizing});
+  stats.phases.push_back({"assembly", statsElapsed(begin) - lexing - optimizing});
+  stats.lexed = stream.lexed;
+  stats.instructions = pc;
   verbose(options, "Compilation completed successfully.");
   std::cout << "Output written to: " << options.output_file_name << std::endl;
-  std::cout << "Program size: " << instructions.size() << " instructions." << std::endl;
-  delete arch; // Clean up architecture object
-  FILE * outputFile = fileWrite(options.output_file_name.c_str());
-  fprintf(outputFile, "%s", program.c_str());
-  fclose(outputFile);
+  std::cout << "Program size: " << pc << " instructions." << std::endl;
   verbose(options, "Output file written successfully.");
-  verbose(options,program.c_str());
+}
 
+/**
+ * @brief runs the program at compile time up to its first input, see evalProgram, and replaces it with the code left to run.
+ * Unoptimized and --profile runs are not evaluated, the profile has to count every loop from the start.
+ * @param loop_origins If not NULL, the origins of the loops, for the loops of the code left.
+ * @param snapshot Receives the output, the tape and the tape position the code left starts with.
+ */
+static void partialEvaluation(instructions_list &instructions, CompilerOptions &options, std::map<InstructionType,uint32_t> &instructions_map,
+                              std::vector<uint32_t> *loop_origins, eval_state_t &snapshot) {
+  if(!options.optimize || options.profile || options.eval_budget <= 0)
+    return;
+  stats_clock_t start = statsStart();
+  evalProgram(instructions, options, snapshot);
+  if(snapshot.pc > 0){
+    instructions = evalResidual(instructions, snapshot.pc, loop_origins);
+    for(auto &pair : instructions_map)
+      pair.second = 0;
+    for(Instruction i : instructions)
+      instructions_map[i.type]++;
+  }
+  stats.evaluated = snapshot.steps;
+  stats.instructions = instructions.size();
+  statsPhase("evaluate", start);
 }
 
-void jit_compiler(instructions_list instructions,CompilerOptions options,std::map<InstructionType,uint16_t> &instructions_map) {
+void jit_compiler(const instructions_list &instructions,CompilerOptions options,std::map<InstructionType,uint32_t> &instructions_map,
+                  const std::vector<uint32_t> &loop_origins, const eval_state_t &snapshot) {
   //ArchitectureInterface *arch = getJITArch(options.target_arch); 
-  // using std::chrono::duration_cast;
-  // using std::chrono::nanoseconds;
-  // typedef std::chrono::high_resolution_clock clock;
-
-  //auto start = clock::now();
-  uint8_t branch_adress_size;
   JIT_init_t init;
 
-  JITInterface *arch = new X86JIT(&init); 
-
-  size_t jitSize=0;
-  for(auto &pair : instructions_map) {
-    
-    jitSize += pair.second * init.instructions_size[static_cast<uint8_t>(pair.first)]; 
+  // the JIT runs on this machine, whatever the target of the assembly backends is
+  getSystemArch();
+  JITInterface *arch = getJITArch(system_arch, &init);
+  if(arch == NULL) {
+    verbose(options, "No JIT for this architecture, falling back to the interpreter.");
+    interpret(instructions, options, &snapshot);
+    return;
   }
-  jitSize+= init.instructions_size[static_cast<uint8_t>(InstructionType::UNKNOWN)]; // Add size for proStart and proEnd
-  verbose(options, "JIT code size: " + std::to_string(jitSize) + " bytes.");
-  branch_adress_size = init.branch_address_size;
-
-  uint64_t pc =0;
-  jit_code_t*jit = create_JITCode(jitSize);
-  std::stack<uint32_t> branch_stack; // Stack to handle branches
-  arch->proStart(jit);
-  for(Instruction instruction : instructions){
-    switch(instruction.type){
-      case InstructionType::ADD:
-        arch->add(jit,instruction.extra);
-      break;
-      case InstructionType::SUB:
-        arch->sub(jit,instruction.extra);
-        break;
-      case InstructionType::INC:
-        arch->inc(jit,instruction.extra);
-      break;
-      case InstructionType::DEC:
-        arch->dec(jit,instruction.extra);
-      break;
-      case InstructionType::INPUT:
-        arch->input(jit);
-      break;
-      case InstructionType::OUTPUT:
-        arch->output(jit);
-      break;
-      case InstructionType::MOV0:
-        arch->mov0(jit);
-      break;
-      case InstructionType::ADDTO:
-        arch->addto(jit,instruction.extra);
-      break;
-      case InstructionType::BEQZ:
-
-        arch->beqz(jit);
-        branch_stack.push(jit->code_size);
-      break;
-      case InstructionType::BNEQ:
-        uint32_t branch_address = branch_stack.top();
-        branch_stack.pop();
-        arch->bneq(jit,branch_address);
-
-        int32_t jump_distance = static_cast<int32_t>(jit->code_size - branch_address);
-        
-        memcpy((char*)jit->code_buf + branch_address-branch_adress_size, &jump_distance, INT32_S); // Patch the jump distance
-      break; 
-    }
-    pc++;
+  profile_t profile;
+  bool profiled = options.profile || !options.profile_use.empty();
+  if(profiled || options.perf_map){
+    profileInit(profile, instructions, loop_origins);
+    profile.instrument = options.profile;
+    if(!options.profile_use.empty())
+      profileLoad(profile, instructions, options);
+  }
+  jit_lazy_t lazy;
+  jit_code_t*jit;
+  size_t entry = 0;
+  std::vector<uint32_t> addresses; // code of every top level instruction, for the symbols of --perf-map
+  stats_clock_t start = statsStart();
+  if(options.lazy) {
+    lazy.arch = arch;
+    lazy.init = &init;
+    lazy.instructions = &instructions;
+    lazy.options = options;
+    lazy.profile = profiled ? &profile : NULL;
+    lazy.addresses = options.perf_map ? &addresses : NULL;
+    entry = jitCompileLazy(lazy, instructions_map);
+    jit = lazy.jit;
   }
-  arch->proEnd(jit);
+  else
+    jit = jitCompile(arch, init, instructions, options, instructions_map, profiled ? &profile : NULL,
+                     options.perf_map ? &addresses : NULL);
+  statsPhase("jit compile", start);
 
-  //auto end = clock::now();
-  //std::cout << "JIT compilation completed in: " << duration_cast<nanoseconds>(end-start).count() << "ns" << std::endl;
-  
-  
   verbose(options, "Compilation completed successfully. Preparing memory for JIT execution.");
   //hexDump(jit);
-  void *mem = calloc(options.max_memory, sizeof(uint8_t));
+  void *mem = calloc(options.max_memory + 2*JIT_TAPE_GUARD, sizeof(uint8_t));
   if (mem == NULL) {
     std::cerr << "Error: Memory allocation failed." << std::endl;
     delete arch;
     exit(EXIT_FAILURE);
   }
+  jit_io_t *io = (jit_io_t*)malloc(sizeof(jit_io_t));
+  if (io == NULL) {
+    std::cerr << "Error: Memory allocation failed." << std::endl;
+    free(mem);
+    delete arch;
+    exit(EXIT_FAILURE);
+  }
+  uint8_t *tape = (uint8_t*)mem + JIT_TAPE_GUARD;
+  std::copy(snapshot.memory.begin(), snapshot.memory.end(), tape);
   verbose(options, "Memory allocated successfully.");
 
 
-  if (mprotect(jit->code_buf, jit->memory_size, PROT_READ | PROT_EXEC) != 0) {
+  // lazy code is patched while it runs, the buffer is left writable
+  if (!options.lazy && mprotect(jit->code_buf, jit->memory_size, PROT_READ | PROT_EXEC) != 0) {
     std::cerr << "Error: Failed to make memory executable." << std::endl;
     munmap(jit->code_buf, jit->memory_size);
     free(mem);
+    free(io);
     delete arch;
     exit(EXIT_FAILURE);
   }
   verbose(options, "Memory made executable successfully.");
 
   // Execute the JIT compiled code
-  void (*run)(void *memory) = (void (*)(void*))jit->code_buf;
-  //start = clock::now();
-  run(mem);
-  //end = clock::now();
-  //std::cout << "JIT execution completed in: " << duration_cast<nanoseconds>(end-start).count() << "ns" << std::endl;
+  void (*run)(void *memory, jit_io_t *io) = (void (*)(void*, jit_io_t*))((char*)jit->code_buf + entry);
+  perf_map_t perf_map;
+  if(options.perf_map){
+    perfMapOpen(perf_map, options, init.elf_machine);
+    perfMapProgram(perf_map, (const uint8_t*)jit->code_buf, jit->code_size, instructions, profile, addresses, options);
+  }
+  perf_counters_t counters;
+  bool counting = options.perf_counters && countersOpen(counters);
+  if(options.perf_counters && !counting)
+    std::cerr << "Warning: Performance counters unavailable: " << strerror(counters.error) << ", running without them." << std::endl;
+  start = statsStart();
+  // what the program printed at compile time, before anything it prints from here
+  fwrite(snapshot.output.data(), 1, snapshot.output.size(), stdout);
+  fflush(stdout);
+  if(counting)
+    countersStart(counters);
+  run(tape + snapshot.head, io);
+  if(counting)
+    countersStop(counters);
+  statsPhase("run", start);
   verbose(options, "JIT execution completed successfully.");
+  if(options.lazy){
+    stats.code_bytes += jit->code_size; // with the loops compiled while running
+    verbose(options, std::to_string(lazy.compiled) + " of " + std::to_string(lazy.stubs.size()) + " top level loops compiled.");
+  }
+  if(options.profile)
+    profileReport(profile, instructions, options);
+  if(!options.profile_out.empty())
+    profileSave(profile, options);
+  if(counting)
+    countersReport(counters);
+  if(options.perf_map){
+    // loops compiled on first entry were not in the buffer when the program was named
+    for(auto &body : lazy.bodies)
+      perfMapSymbol(perf_map, (const uint8_t*)jit->code_buf + body.second.start, body.second.size, perf_map.loop_names[body.first]);
+    perfMapClose(perf_map);
+  }
   //munmap(jit->code_buf, jitSize);
   //free(mem);
+  free(io);
   delete arch;
 }
 
-
 /**
- * main optimisation passes:
- * -  [-] || [+] -> move_0
- * -  []
+ * @brief runs the program with the JIT up to the first breakpoint, a # in the source or a --break, then hands the live
+ * tape, pointer and buffered input to the stepping debugger, so only the part of interest is traced.
+ * Without a JIT for this machine the whole program is stepped.
  */
-void compilerPasses(instructions_list &instructions,CompilerOptions options) {
-  verbose(options, "Starting compiler passes for optimization.");
-  std::stack<uint32_t> branch_stack;
-  for(size_t j=0;j<instructions.size();j++){
-    Instruction i = instructions[j];
-    if(i.type==InstructionType::BEQZ){
-      branch_stack.push(j);
-    }
-    if(i.type==InstructionType::BNEQ){
-      
-      uint32_t branch_address = branch_stack.top();
-      branch_stack.pop();
-      int cas =j-branch_address;
-      
-      switch(cas){
-        case OPT_MOV0:// move 0 instructions or find next free
-          if(instructions[j-1].type==InstructionType::ADD || instructions[j-1].type==InstructionType::SUB){
-            instructions[branch_address].type = InstructionType::MOV0;
-            instructions.erase(instructions.begin()+j-1);
-            instructions.erase(instructions.begin()+j-1);
-            j-=2; // Adjust index after erasing instructions
-          }
-        break;
-        case OPT_ADDTO:// add current cell to n-th then zero current cell
-          if(((instructions[j-1].type==InstructionType::INC && instructions[j-3].type==InstructionType::DEC) || 
-          (instructions[j-1].type==InstructionType::DEC && instructions[j-3].type==InstructionType::INC)) &&
-          instructions[j-3].extra==instructions[j-1].extra&& instructions[j-2].type==InstructionType::ADD&&
-          instructions[j-4].type==InstructionType::SUB){
-            
-            instructions[j].type = InstructionType::ADDTO;
-            //to compute both [->-<] right and left [-<->] it's sufficent to change the signe of the operand
-            if(instructions[j-1].type==InstructionType::INC)instructions[j].extra = static_cast<uint8_t>(-instructions[j-1].extra);
-            else instructions[j].extra = static_cast<uint8_t>(instructions[j-1].extra);
-            
-            instructions.erase(instructions.begin()+j-5,instructions.begin()+j);
-            j-=5; 
-          }
-        break;
-
-      }
-    }
+void jit_debugger(const instructions_list &instructions,CompilerOptions options,std::map<InstructionType,uint32_t> &instructions_map) {
+  JIT_init_t init;
+  getSystemArch();
+  JITInterface *arch = getJITArch(system_arch, &init);
+  if(arch == NULL) {
+    verbose(options, "No JIT for this architecture, debugging from the start.");
+    debug(instructions, options);
+    return;
   }
-  // for(int k=0;k<instructions.size();k++){
-  //   std::cout << "Instruction " << k << ": Type = " << static_cast<char>(instructions[k].type) 
-  //             << ", Extra = " << static_cast<int>(instructions[k].extra )<< std::endl;
-  // }
+  instructions_map[InstructionType::BREAK] += options.breakpoints.size();
+  jit_code_t*jit = jitCompile(arch, init, instructions, options, instructions_map);
+  uint8_t *mem = (uint8_t*)calloc(options.max_memory + 2*JIT_TAPE_GUARD, sizeof(uint8_t));
+  jit_io_t *io = (jit_io_t*)malloc(sizeof(jit_io_t));
+  if (mem == NULL || io == NULL) {
+    std::cerr << "Error: Memory allocation failed." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (mprotect(jit->code_buf, jit->memory_size, PROT_READ | PROT_EXEC) != 0) {
+    std::cerr << "Error: Failed to make memory executable." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  io->break_pc = JIT_NO_BREAK;
+  uint8_t *tape = mem + JIT_TAPE_GUARD;
+  void* (*run)(void *memory, jit_io_t *io) = (void* (*)(void*, jit_io_t*))jit->code_buf;
+  uint8_t *pointer = (uint8_t*)run(tape, io);
+  if(io->break_pc == JIT_NO_BREAK) {
+    std::cout << "No breakpoint reached." << std::endl;
+    exit(EXIT_SUCCESS);
+  }
+  std::cout << "Breakpoint at instruction " << io->break_pc << ", tape position " << pointer - tape << "." << std::endl;
 
+  debug_state_t state;
+  state.pc = io->break_pc;
+  state.head = pointer - tape;
+  state.memory.assign(tape, tape + options.max_memory);
+  state.input.assign((char*)io->in + io->in_pos, (char*)io->in + io->in_end);
+  munmap(jit->code_buf, jit->memory_size);
+  free(jit);
+  free(io);
+  free(mem);
+  delete arch;
+  debug(instructions, options, state);
 }
 
+/**
+ * @brief compiles the program with the JIT backend and writes it as a static ELF executable instead of running it.
+ * The executable holds the same machine code the JIT would run, an entry point calling it
+ * and a writable segment for the guarded tape and the I/O buffers, so no assembler or linker is needed.
+ * The output and the tape of the snapshot are initialized data of that segment, the entry point writes the output
+ * with a single system call and starts the program on the cell the snapshot stopped at.
+ */
+void elf_compiler(const instructions_list &instructions,CompilerOptions options,std::map<InstructionType,uint32_t> &instructions_map,
+                  const eval_state_t &snapshot) {
+  JIT_init_t init;
+  JITInterface *arch = getJITArch(options.target_arch, &init);
+  if(arch == NULL || init.elf_machine == 0) {
+    std::cerr << "Error: ELF output is only available for x86_64." << std::endl;
+    delete arch;
+    exit(EXIT_FAILURE);
+  }
+  jit_code_t*jit = jitCompile(arch, init, instructions, options, instructions_map);
 
+  // the writable segment: output of the snapshot, guarded tape, I/O buffers; the tape stays page aligned plus the guard
+  size_t entry = jit->code_size;
+  uint64_t output = elfBssAddress(entry);
+  uint64_t output_area = (snapshot.output.size() + ELF_PAGE_SIZE - 1) / ELF_PAGE_SIZE * ELF_PAGE_SIZE;
+  uint64_t tape = output + output_area + JIT_TAPE_GUARD;
+  uint64_t io = tape + options.max_memory + JIT_TAPE_GUARD;
+  uint64_t bss_size = output_area + 2*JIT_TAPE_GUARD + options.max_memory + sizeof(jit_io_t);
+  if(io + sizeof(jit_io_t) > UINT32_MAX) {
+    std::cerr << "Error: The tape of an ELF executable must fit in the first 4GB." << std::endl;
+    delete arch;
+    exit(EXIT_FAILURE);
+  }
+  // only the tape up to its last cell set goes in the file, the rest is zero filled by the loader
+  std::vector<uint8_t> data(snapshot.output);
+  size_t cells = snapshot.memory.size();
+  while(cells > 0 && snapshot.memory[cells-1] == 0)
+    cells--;
+  if(cells > 0){
+    data.resize(output_area + JIT_TAPE_GUARD);
+    data.insert(data.end(), snapshot.memory.begin(), snapshot.memory.begin() + cells);
+  }
+  arch->elfEntry(jit, static_cast<uint32_t>(tape + snapshot.head), static_cast<uint32_t>(io), static_cast<uint32_t>(output),
+                 static_cast<uint32_t>(snapshot.output.size()));
+  elfWrite(options.output_file_name, init.elf_machine, jit, entry, bss_size, data.data(), data.size());
+  std::cout << "Output written to: " << options.output_file_name << std::endl;
+  std::cout << "Program size: " << jit->code_size << " bytes of code." << std::endl;
+  munmap(jit->code_buf, jit->memory_size);
+  free(jit);
+  delete arch;
+}
 
 int main(int argc, char* argv[]){
-  // using std::chrono::duration_cast;
-  // using std::chrono::nanoseconds;
-  // typedef std::chrono::high_resolution_clock clock;
-  // auto start = clock::now();
+  if(argc > 1 && std::string(argv[1]) == "decode")
+    return traceDecode(argc - 2, argv + 2);
+  stats_clock_t start = statsStart();
   CompilerOptions options = getCompilerOptions(argc, argv);  
-  //auto end = clock::now();
-  //std::cout <<"compiler options: "<< duration_cast<nanoseconds>(end-start).count() << "ns"<<std::endl;
+  statsPhase("options", start);
 
   verbose(options, "Compiling Brainfuck source file: "+options.source_file_name+" as: "+options.output_file_name);
-  std::map<InstructionType,uint16_t> instructions_map= {
+  std::map<InstructionType,uint32_t> instructions_map= {
     {InstructionType::ADD, 0},
     {InstructionType::SUB, 0},
     {InstructionType::INC, 0},
@@ -254,30 +429,57 @@ int main(int argc, char* argv[]){
     {InstructionType::UNKNOWN, 0}
   };
 
-  //start = clock::now();
-    
+  if(!options.debug && !options.interp && !options.tiered && !options.jit && !options.elf){
+    verbose(options, "Compiling...");
+    compiler(options, instructions_map); // lexes the source itself, a window at a time
+    if(options.stats)
+      statsReport(options);
+    return 0;
+  }
+
+  start = statsStart();
   instructions_list instructions = lexer(options,instructions_map);
-  //end = clock::now();
-  //std::cout <<"lexer: "<< duration_cast<nanoseconds>(end-start).count() << "ns"<<std::endl;
+  statsPhase("lexer", start);
+  stats.lexed = instructions.size();
   verbose(options, "Translation completed");
   if(options.debug) {
     std::cout << "Debugging enabled." << std::endl;
-    debug(instructions, options);
+    if(instructions_map[InstructionType::BREAK] > 0 || !options.breakpoints.empty())
+      jit_debugger(instructions, options, instructions_map);
+    else
+      debug(instructions, options);
   }
-  if(options.jit) {
-    if(options.optimize){
-      verbose(options, "Running compiler passes for optimization.");
-      compilerPasses(instructions, options);
-    }
-
-    verbose(options, "Just-In-Time compilation enabled.");
-    jit_compiler(instructions, options,instructions_map);
+  std::vector<uint32_t> loop_origins; // where the loops left by the passes are in the source, for the profiles and --perf-map
+  if(options.optimize){
+    verbose(options, "Running compiler passes for optimization.");
+    start = statsStart();
+    runPasses(instructions, options, instructions_map, options.profile || !options.profile_use.empty() || options.perf_map ? &loop_origins : NULL);
+    statsPhase("passes", start);
   }
-  else{
-    verbose(options, "Compiling..."); 
-    compiler(instructions,options);
-
+  stats.instructions = instructions.size();
+  if(options.interp || options.tiered) {
+    verbose(options, options.tiered ? "Tiered execution." : "Interpreting.");
+    start = statsStart();
+    interpret(instructions, options);
+    statsPhase(options.tiered ? "tiered run" : "interpret", start);
+  }
+  else if(options.jit || options.elf) {
+    eval_state_t snapshot; // where the program starts, the first cell of an empty tape unless it was evaluated
+    partialEvaluation(instructions, options, instructions_map,
+                      !options.profile_use.empty() || options.perf_map ? &loop_origins : NULL, snapshot);
+    if(options.elf) {
+      verbose(options, "Writing an ELF executable.");
+      start = statsStart();
+      elf_compiler(instructions, options, instructions_map, snapshot);
+      statsPhase("elf", start);
+    }
+    else {
+      verbose(options, "Just-In-Time compilation enabled.");
+      jit_compiler(instructions, options,instructions_map, loop_origins, snapshot);
+    }
   }
+  if(options.stats)
+    statsReport(options);
 
 
   return 0;
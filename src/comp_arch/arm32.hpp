@@ -8,45 +8,120 @@ class ARM32: public ArchitectureInterface {
     };
 
     std::string proStart(uint64_t tape_size)override{
-      return ".bss\n.lcomm tape,"+std::to_string(tape_size)+"\n.text\n.global _start \n_start:\nldr r1, =tape\nmov r2,#1\n";
+      return ".bss\n.lcomm tape,"+std::to_string(tape_size)+"\n.text\n.global _start \n_start:\nldr r1, =tape\nmov r2,#1\nb start\n.ltorg\nstart:\n"; // the literal pool of tape stays in reach in large programs
     };
-    
+
     virtual std::string proEnd()override{
       return "mov r0, #0\nmov r7, #1\nswi 0";
     };
-    
-    virtual std::string add(uint8_t count)override{
-      return "ldrb r0, [r1]\nadd r0,r0,#"+std::to_string(count)+"\nstrb r0, [r1]\n";
+
+    virtual std::string add(uint8_t count, int32_t offset)override{
+      std::string address = cell(offset, "r3");
+      return setup+"ldrb r0, "+address+"\nadd r0,r0,#"+std::to_string(count)+"\nstrb r0, "+address+"\n";
     };
-    
-    virtual std::string sub(uint8_t count)override{
-      return "ldrb r0, [r1]\nsub r0,r0,#"+std::to_string(count)+"\nstrb r0, [r1]\n";
+
+    virtual std::string sub(uint8_t count, int32_t offset)override{
+      std::string address = cell(offset, "r3");
+      return setup+"ldrb r0, "+address+"\nsub r0,r0,#"+std::to_string(count)+"\nstrb r0, "+address+"\n";
     };
-    
-    virtual std::string output()override{
-      return "mov r7,#4\nmov r0,#1\nswi 0\n";
+
+    virtual std::string output(int32_t offset)override{
+      // write takes the buffer in r1, so the pointer is moved on the cell and back
+      return move(offset)+"mov r7,#4\nmov r0,#1\nswi 0\n"+move(-static_cast<int64_t>(offset));
     };
-    
-    virtual std::string input()override{
-      return "mov r7,#3\nmov r0,#1\nswi 0\n";
+
+    virtual std::string input(int32_t offset)override{
+      return move(offset)+"mov r7,#3\nmov r0,#0\nswi 0\n"+move(-static_cast<int64_t>(offset));
     };
-    
-    virtual std::string inc(uint8_t count)override{
-      return "add r1, r1, #"+std::to_string(count)+"\n";
+
+    virtual std::string inc(uint32_t count)override{
+      return move(count);
     };
-    
-    virtual std::string dec(uint8_t count)override{
-      return "sub r1, r1, #"+std::to_string(count)+"\n";
+
+    virtual std::string dec(uint32_t count)override{
+      return move(-static_cast<int64_t>(count));
     };
-    
-    virtual std::string bneq(uint64_t pc, uint64_t jump)override{
-      return "lable_"+std::to_string(pc)+":\n ldrb r0, [r1]\ncmp r0, #0\nbne lable_"+std::to_string(jump)+"\n";
+
+    virtual std::string bneq(uint64_t loop)override{
+      return label(loop)+" ldrb r0, [r1]\ncmp r0, #0\nbne lable_"+std::to_string(loop)+"\n";
+    };
+
+    virtual std::string beqz(uint64_t pc, int32_t offset)override{
+      std::string address = cell(offset, "r3");
+      return setup+"ldrb r0, "+address+"\ncmp r0, #0\nbeq lable_"+std::to_string(pc)+"_end\nlable_"+std::to_string(pc)+":\n ";
     };
-    
-    virtual std::string beqz(uint64_t pc, uint64_t jump)override{
-      return "ldrb r0, [r1]\ncmp r0, #0\nbeq lable_"+std::to_string(jump)+"\nlable_"+std::to_string(pc)+":\n ";
+
+    virtual std::string label(uint64_t pc)override{
+      return "lable_"+std::to_string(pc)+"_end:\n";
+    };
+
+    virtual std::string mov0(int32_t offset)override{
+      std::string address = cell(offset, "r3");
+      return setup+"mov r0, #0\nstrb r0, "+address+"\n";
     };
-          
+
+    virtual std::string mul(int32_t source, int32_t target, uint8_t factor)override{
+      std::string code;
+      std::string address = cell(source, "r3");
+      code += setup+"ldrb r0, "+address+"\n";
+      if(factor != 1 && factor != 255){
+        code += "mov r4, #"+std::to_string(factor)+"\nmul r5, r0, r4\nmov r0, r5\n";
+      }
+      address = cell(target, "r3");
+      code += setup+"ldrb r4, "+address+"\n";
+      code += std::string(factor == 255 ? "sub" : "add")+" r4, r4, r0\nstrb r4, "+address+"\n";
+      return code;
+    };
+
+    virtual std::string scan(uint64_t pc, int32_t stride)override{
+      std::string loop = "scan_"+std::to_string(pc);
+      return loop+":\nldrb r0, [r1]\ncmp r0, #0\nbeq "+loop+"_end\n"+move(stride)+"b "+loop+"\n"+loop+"_end:\n";
+    };
+
+  private:
+    std::string setup; // instructions computing the address returned by the last cell call
+
+    /**
+     * @brief returns the memory operand of the cell at offset from the current pointer.
+     * ldrb and strb take offsets up to 4095, farther cells are addressed through the scratch register,
+     * the instructions computing it are left in setup.
+     */
+    std::string cell(int32_t offset, std::string scratch){
+      setup = "";
+      if(offset == 0)
+        return "[r1]";
+      if(offset >= -4095 && offset <= 4095)
+        return "[r1, #"+std::to_string(offset)+"]";
+      setup = constant(scratch, static_cast<uint32_t>(offset))+"add "+scratch+", r1, "+scratch+"\n";
+      return "["+scratch+"]";
+    };
+
+    /**
+     * @brief returns the instructions moving the pointer by offset cells, nothing for 0.
+     * offsets up to 255 fit the immediate of add and sub, the others are built in r3.
+     */
+    std::string move(int64_t offset){
+      if(offset == 0)
+        return "";
+      std::string op = offset > 0 ? "add" : "sub";
+      uint32_t count = static_cast<uint32_t>(offset > 0 ? offset : -offset);
+      if(count <= 255)
+        return op+" r1, r1, #"+std::to_string(count)+"\n";
+      return constant("r3", count)+op+" r1, r1, r3\n";
+    };
+
+    /**
+     * @brief returns the instructions loading value into reg, one byte at a time as each one fits an immediate.
+     * unlike ldr reg, =value this needs no literal pool, that would be out of reach in large programs.
+     */
+    std::string constant(std::string reg, uint32_t value){
+      std::string code = "mov "+reg+", #"+std::to_string(value & 0xFF)+"\n";
+      for(int shift = 8; shift < 32; shift += 8)
+        if((value >> shift) & 0xFF)
+          code += "orr "+reg+", "+reg+", #"+std::to_string(value & (0xFFu << shift))+"\n";
+      return code;
+    };
+
 };
 
-#endif
\ No newline at end of file
+#endif
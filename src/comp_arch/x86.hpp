@@ -7,46 +7,86 @@ class X86: public ArchitectureInterface {
       std::cout << "x86 architecture" << std::endl;
     }
     std::string proStart(uint64_t tape_size)override{
-      return "section\t.bss\ntape: resd "+std::to_string(tape_size)+"\nsection .text\nglobal _start \n_start:\nmov rsi, tape\nmov rdi, 1\n";
+      return "section\t.bss\ntape: resb "+std::to_string(tape_size)+"\nsection .text\nglobal _start \n_start:\nmov rsi, tape\nmov rdi, 1\n";
     };
-    
+
     virtual std::string proEnd()override{
-      return "mov rax, 10\nmov [rsi], rax\n"+this->output()+"mov rax, 60\nmov rdi, 0\nsyscall\n";
+      return "mov byte [rsi], 10\n"+this->output(0)+"mov rax, 60\nmov rdi, 0\nsyscall\n";
     };
-    
-    virtual std::string add(uint8_t count)override{
-      return "mov rax, [rsi]\nadd rax, "+std::to_string(count)+"\nmov [rsi], rax\n";
+
+    virtual std::string add(uint8_t count, int32_t offset)override{
+      return "add byte "+cell(offset)+", "+std::to_string(count)+"\n";
     };
-    
-    virtual std::string sub(uint8_t count)override{
-      return "mov rax, [rsi]\nsub rax, "+std::to_string(count)+"\nmov [rsi], rax\n";
+
+    virtual std::string sub(uint8_t count, int32_t offset)override{
+      return "sub byte "+cell(offset)+", "+std::to_string(count)+"\n";
     };
-    
-    virtual std::string output()override{
-      return "mov rax, 1\nmov rdx, 1\nsyscall\n";
+
+    virtual std::string output(int32_t offset)override{
+      // write takes the buffer in rsi, so the pointer is moved on the cell and back
+      return "mov rax, 1\nmov rdx, 1\n"+move(offset)+"syscall\n"+move(-offset);
     };
-    
-    virtual std::string input()override{
-      return "mov rax, 0\nmov rdx, 1\nsyscall\n";
+
+    virtual std::string input(int32_t offset)override{
+      return "mov rax, 0\nmov rdi, 0\nmov rdx, 1\n"+move(offset)+"syscall\n"+move(-offset)+"mov rdi, 1\n";
     };
-    
-    virtual std::string inc(uint8_t count)override{
+
+    virtual std::string inc(uint32_t count)override{
       return "add rsi, "+std::to_string(count)+"\n";
     };
-    
-    virtual std::string dec(uint8_t count)override{
+
+    virtual std::string dec(uint32_t count)override{
       return "sub rsi, "+std::to_string(count)+"\n";
     };
-    
-    virtual std::string bneq(uint64_t pc, uint64_t jump)override{
-      return "lable_"+std::to_string(pc)+":\n mov rax, [rsi]\ncmp rax, 0\n jne lable_"+std::to_string(jump)+"\n";
+
+    virtual std::string bneq(uint64_t loop)override{
+      return label(loop)+" cmp byte [rsi], 0\n jne lable_"+std::to_string(loop)+"\n";
+    };
+
+    virtual std::string beqz(uint64_t pc, int32_t offset)override{
+      return "cmp byte "+cell(offset)+", 0\nje lable_"+std::to_string(pc)+"_end\nlable_"+std::to_string(pc)+":\n ";
+    };
+
+    virtual std::string label(uint64_t pc)override{
+      return "lable_"+std::to_string(pc)+"_end:\n";
+    };
+
+    virtual std::string mov0(int32_t offset)override{
+      return "mov byte "+cell(offset)+", 0\n";
+    };
+
+    virtual std::string mul(int32_t source, int32_t target, uint8_t factor)override{
+      if(factor == 1)
+        return "mov al, "+cell(source)+"\nadd "+cell(target)+", al\n";
+      if(factor == 255)
+        return "mov al, "+cell(source)+"\nsub "+cell(target)+", al\n";
+      return "movzx eax, byte "+cell(source)+"\nimul eax, eax, "+std::to_string(factor)+"\nadd "+cell(target)+", al\n";
     };
-    
-    virtual std::string beqz(uint64_t pc, uint64_t jump)override{
-      return "mov rax, [rsi]\ncmp rax, 0\nje lable_"+std::to_string(jump)+"\nlable_"+std::to_string(pc)+":\n ";
+
+    virtual std::string scan(uint64_t pc, int32_t stride)override{
+      std::string loop = "scan_"+std::to_string(pc);
+      return loop+":\ncmp byte [rsi], 0\nje "+loop+"_end\n"+move(stride)+"jmp "+loop+"\n"+loop+"_end:\n";
     };
 
+  private:
+    /**
+     * @brief returns the memory operand of the cell at offset from the current pointer.
+     */
+    std::string cell(int32_t offset){
+      if(offset == 0)
+        return "[rsi]";
+      return offset > 0 ? "[rsi+"+std::to_string(offset)+"]" : "[rsi-"+std::to_string(-static_cast<int64_t>(offset))+"]";
+    };
+
+    /**
+     * @brief returns the instruction moving the pointer by offset cells, nothing for 0.
+     */
+    std::string move(int32_t offset){
+      if(offset == 0)
+        return "";
+      return offset > 0 ? inc(offset) : dec(static_cast<uint32_t>(-static_cast<int64_t>(offset)));
+    };
 
 };
 
-#endif
\ No newline at end of file
+#endif
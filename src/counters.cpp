@@ -0,0 +1,121 @@
+#include "counters.hpp"
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+
+enum counter_event_t {
+  COUNTER_TASK_CLOCK,   // software, nanoseconds on the CPU: available even where the hardware events are not
+  COUNTER_CYCLES,
+  COUNTER_INSTRUCTIONS,
+  COUNTER_BRANCHES,
+  COUNTER_BRANCH_MISSES,
+  COUNTER_L1I_MISSES,
+  COUNTER_L1D_MISSES,
+  COUNTER_ITLB_MISSES
+};
+
+/**
+ * @brief returns the config of a read miss in cache, for the PERF_TYPE_HW_CACHE events.
+ */
+static constexpr uint64_t cacheMiss(uint64_t cache) {
+  return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+static const struct{
+  uint32_t type;
+  uint64_t config;
+}events[COUNTERS_EVENTS] = {
+  {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+  {PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_L1I)},
+  {PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_L1D)},
+  {PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_ITLB)},
+};
+
+bool countersOpen(perf_counters_t &counters) {
+  bool opened = false;
+  counters.error = 0;
+  for(int e=0;e<COUNTERS_EVENTS;e++){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[e].type;
+    attr.config = events[e].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // glibc has no wrapper for perf_event_open
+    counters.fd[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    counters.value[e] = 0;
+    if(counters.fd[e] < 0 && counters.error == 0)
+      counters.error = errno;
+    opened |= counters.fd[e] >= 0;
+  }
+  return opened;
+}
+
+void countersStart(perf_counters_t &counters) {
+  for(int e=0;e<COUNTERS_EVENTS;e++){
+    if(counters.fd[e] < 0)
+      continue;
+    ioctl(counters.fd[e], PERF_EVENT_IOC_RESET, 0);
+    ioctl(counters.fd[e], PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+void countersStop(perf_counters_t &counters) {
+  for(int e=0;e<COUNTERS_EVENTS;e++)
+    if(counters.fd[e] >= 0)
+      ioctl(counters.fd[e], PERF_EVENT_IOC_DISABLE, 0);
+  for(int e=0;e<COUNTERS_EVENTS;e++){
+    if(counters.fd[e] < 0)
+      continue;
+    if(read(counters.fd[e], &counters.value[e], sizeof(uint64_t)) != sizeof(uint64_t)){
+      close(counters.fd[e]);
+      counters.fd[e] = -1;
+      continue;
+    }
+    close(counters.fd[e]);
+  }
+}
+
+/**
+ * @brief prints a line of the report, the value of event or "not supported".
+ */
+static void reportLine(const perf_counters_t &counters, const char *name, int event, const std::string &note = "") {
+  if(counters.fd[event] < 0)
+    fprintf(stderr, "  %-20s %18s\n", name, "not supported");
+  else
+    fprintf(stderr, "  %-20s %18lu%s\n", name, counters.value[event], note.c_str());
+}
+
+void countersReport(const perf_counters_t &counters) {
+  const uint64_t *v = counters.value;
+  auto available = [&](int event){ return counters.fd[event] >= 0; };
+  char note[64];
+  fprintf(stderr, "Performance counters of the generated code:\n");
+  if(available(COUNTER_TASK_CLOCK))
+    fprintf(stderr, "  %-20s %18.3f ms\n", "task clock", v[COUNTER_TASK_CLOCK] / 1e6);
+  reportLine(counters, "cycles", COUNTER_CYCLES);
+  note[0] = '\0';
+  if(available(COUNTER_CYCLES) && available(COUNTER_INSTRUCTIONS) && v[COUNTER_CYCLES])
+    snprintf(note, sizeof(note), "  %.2f IPC", static_cast<double>(v[COUNTER_INSTRUCTIONS]) / v[COUNTER_CYCLES]);
+  reportLine(counters, "instructions", COUNTER_INSTRUCTIONS, note);
+  reportLine(counters, "branches", COUNTER_BRANCHES);
+  note[0] = '\0';
+  if(available(COUNTER_BRANCHES) && available(COUNTER_BRANCH_MISSES) && v[COUNTER_BRANCHES])
+    snprintf(note, sizeof(note), "  %.2f%% of branches", 100.0 * v[COUNTER_BRANCH_MISSES] / v[COUNTER_BRANCHES]);
+  reportLine(counters, "branch mispredicts", COUNTER_BRANCH_MISSES, note);
+  reportLine(counters, "L1i misses", COUNTER_L1I_MISSES);
+  reportLine(counters, "L1d read misses", COUNTER_L1D_MISSES);
+  reportLine(counters, "iTLB misses", COUNTER_ITLB_MISSES);
+  if(counters.error == EACCES || counters.error == EPERM)
+    fprintf(stderr, "  Some events could not be opened: %s, see /proc/sys/kernel/perf_event_paranoid.\n", strerror(counters.error));
+  else if(counters.error)
+    fprintf(stderr, "  Some events could not be opened: %s, the CPU or the virtual machine may not expose them.\n", strerror(counters.error));
+}
@@ -0,0 +1,41 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+#include <iostream>
+#include <string>
+#include "utils.hpp"
+
+#define COUNTERS_EVENTS 8
+
+/**
+ * @brief the hardware counters of --perf-counters, opened with perf_event_open on this thread.
+ * Each event is opened on its own, so one the CPU or the kernel does not offer leaves the others working.
+ */
+typedef struct{
+  int fd[COUNTERS_EVENTS];          // -1 for the events that could not be opened
+  uint64_t value[COUNTERS_EVENTS];
+  int error;                        // errno of the first event that failed to open
+}perf_counters_t;
+
+/**
+ * @brief opens the counters, disabled and counting user space only, so the syscalls of the I/O routines are left out.
+ * @return false if no event could be opened, the counters are then ignored.
+ */
+bool countersOpen(perf_counters_t &counters);
+
+/**
+ * @brief resets and enables every open counter, right before the generated code runs.
+ */
+void countersStart(perf_counters_t &counters);
+
+/**
+ * @brief disables the counters, reads them and closes them.
+ */
+void countersStop(perf_counters_t &counters);
+
+/**
+ * @brief prints cycles, instructions, IPC, branch mispredictions, L1i, L1d and iTLB misses on stderr,
+ * "not supported" for the events that could not be opened.
+ */
+void countersReport(const perf_counters_t &counters);
+
+#endif
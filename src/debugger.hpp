@@ -6,8 +6,28 @@
 #include <string.h>
 #include <stack>
 #include <vector>
+#include "trace.hpp"
 
-FILE* debug_file(std::string file_name);
-void debug(instructions_list instructions, CompilerOptions options);
+/**
+ * @brief returns the name of the trace of file_name, with the .dbg extension.
+ */
+std::string debug_file(std::string file_name);
+
+/**
+ * @brief where the debugger starts, the start of the program or the state a breakpoint stopped the JIT in.
+ */
+typedef struct{
+  uint64_t pc = 0;
+  uint64_t head = 0;
+  std::vector<uint8_t> memory;  // the tape, empty for a fresh one
+  std::string input;            // stdin already read ahead by the JIT, consumed before asking for more
+}debug_state_t;
+
+/**
+ * @brief runs the program one instruction at a time and records every step in a binary trace, see trace.hpp.
+ * The trace keeps the last options.trace_size steps and is read back with the decode subcommand.
+ * @param state The instruction, tape and pointer to resume from.
+ */
+void debug(const instructions_list &instructions, CompilerOptions options, debug_state_t state = {});
 
 #endif
\ No newline at end of file
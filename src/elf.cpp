@@ -0,0 +1,63 @@
+#include "elf.hpp"
+#include <sys/stat.h>
+
+uint64_t elfBssAddress(size_t code_size) {
+  uint64_t end = ELF_BASE_ADDRESS + ELF_HEADERS_SIZE + code_size;
+  return (end + ELF_PAGE_SIZE - 1) / ELF_PAGE_SIZE * ELF_PAGE_SIZE + ELF_PAGE_SIZE;
+}
+
+void elfWrite(const std::string &file_name, uint16_t machine, jit_code_t *jit, size_t entry, uint64_t bss_size,
+              const uint8_t *data, size_t data_size) {
+  Elf64_Ehdr header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.e_ident, ELFMAG, SELFMAG);
+  header.e_ident[EI_CLASS] = ELFCLASS64;
+  header.e_ident[EI_DATA] = ELFDATA2LSB;
+  header.e_ident[EI_VERSION] = EV_CURRENT;
+  header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+  header.e_type = ET_EXEC;
+  header.e_machine = machine;
+  header.e_version = EV_CURRENT;
+  header.e_entry = ELF_BASE_ADDRESS + ELF_HEADERS_SIZE + entry;
+  header.e_phoff = sizeof(Elf64_Ehdr);
+  header.e_ehsize = sizeof(Elf64_Ehdr);
+  header.e_phentsize = sizeof(Elf64_Phdr);
+  header.e_phnum = 2;
+
+  Elf64_Phdr segments[2];
+  memset(segments, 0, sizeof(segments));
+  // headers and code
+  segments[0].p_type = PT_LOAD;
+  segments[0].p_flags = PF_R | PF_X;
+  segments[0].p_offset = 0;
+  segments[0].p_vaddr = ELF_BASE_ADDRESS;
+  segments[0].p_paddr = ELF_BASE_ADDRESS;
+  segments[0].p_filesz = ELF_HEADERS_SIZE + jit->code_size;
+  segments[0].p_memsz = segments[0].p_filesz;
+  segments[0].p_align = ELF_PAGE_SIZE;
+  // tape and I/O buffers, only the initialized start is in the file, at an offset as aligned as the address
+  segments[1].p_type = PT_LOAD;
+  segments[1].p_flags = PF_R | PF_W;
+  segments[1].p_offset = data_size ? (segments[0].p_filesz + ELF_PAGE_SIZE - 1) / ELF_PAGE_SIZE * ELF_PAGE_SIZE : 0;
+  segments[1].p_vaddr = elfBssAddress(entry);
+  segments[1].p_paddr = segments[1].p_vaddr;
+  segments[1].p_filesz = data_size;
+  segments[1].p_memsz = bss_size;
+  segments[1].p_align = ELF_PAGE_SIZE;
+
+  FILE *file = fopen(file_name.c_str(), "wb");
+  if (!file) {
+    std::cerr << "Error creating file: " << file_name << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+      fwrite(segments, sizeof(segments), 1, file) != 1 ||
+      fwrite(jit->code_buf, 1, jit->code_size, file) != jit->code_size ||
+      (data_size && (fseek(file, segments[1].p_offset, SEEK_SET) != 0 || fwrite(data, 1, data_size, file) != data_size))) {
+    std::cerr << "Error: Could not write the executable '" << file_name << "'." << std::endl;
+    fclose(file);
+    exit(EXIT_FAILURE);
+  }
+  fclose(file);
+  chmod(file_name.c_str(), 0755);
+}
@@ -0,0 +1,34 @@
+#ifndef ELF_H
+#define ELF_H
+#include <iostream>
+#include <string>
+#include <elf.h>
+#include "utils.hpp"
+
+#define ELF_BASE_ADDRESS 0x400000 // Address the executable is loaded at, code and data stay below 4GB
+#define ELF_PAGE_SIZE 0x1000
+#define ELF_HEADERS_SIZE (sizeof(Elf64_Ehdr) + 2*sizeof(Elf64_Phdr)) // The code starts right after the headers
+
+/**
+ * @brief returns the address of the zero initialized segment of an executable holding code_size bytes of code.
+ * One spare page is left after the code for the entry point emitted once the layout is known.
+ */
+uint64_t elfBssAddress(size_t code_size);
+
+/**
+ * @brief writes a static ELF64 executable made of two segments and no section table.
+ * The first segment is readable and executable and holds the headers followed by the code of jit,
+ * the second one is readable and writable: bss_size bytes at elfBssAddress(entry), starting with the data_size bytes
+ * of data, stored page aligned after the code, and zero initialized past them.
+ * @param file_name The name of the executable, it is created with execute permission.
+ * @param machine The EM_* value of the code.
+ * @param jit The code, loaded at ELF_BASE_ADDRESS + ELF_HEADERS_SIZE.
+ * @param entry The offset in jit of the first instruction to run.
+ * @param bss_size The size of the writable segment.
+ * @param data The initialized start of the writable segment, NULL when it is all zeros.
+ * @param data_size The size of data, at most bss_size.
+ */
+void elfWrite(const std::string &file_name, uint16_t machine, jit_code_t *jit, size_t entry, uint64_t bss_size,
+              const uint8_t *data = NULL, size_t data_size = 0);
+
+#endif
@@ -0,0 +1,140 @@
+#include "evaluator.hpp"
+#include "passes.hpp"
+#include <algorithm>
+
+void evalProgram(const instructions_list &instructions, CompilerOptions &options, eval_state_t &state) {
+  state.memory.assign(options.max_memory, 0);
+  state.output.clear();
+  uint8_t *tape = state.memory.data();
+  int64_t cells = options.max_memory;
+  int64_t head = 0;
+  uint64_t pc = 0, steps = 0;
+  auto inside = [&](int64_t cell){ return cell >= 0 && cell < cells; };
+
+  while(pc < instructions.size() && steps < static_cast<uint64_t>(options.eval_budget)){
+    const Instruction &i = instructions[pc];
+    int64_t cell = head + i.offset;
+    switch(i.type){
+      case InstructionType::ADD:
+        if(!inside(cell))
+          goto stop;
+        tape[cell] += static_cast<uint8_t>(i.extra);
+      break;
+      case InstructionType::SUB:
+        if(!inside(cell))
+          goto stop;
+        tape[cell] -= static_cast<uint8_t>(i.extra);
+      break;
+      case InstructionType::INC:
+        head += i.extra;
+      break;
+      case InstructionType::DEC:
+        head -= i.extra;
+      break;
+      case InstructionType::MOV0:
+        if(!inside(cell))
+          goto stop;
+        tape[cell] = 0;
+      break;
+      case InstructionType::MUL:
+        if(!inside(cell))
+          goto stop;
+        // the target is not touched when the loop would not have run, like the guard of the JIT
+        if(tape[cell]){
+          int64_t target = cell + static_cast<int32_t>(i.extra);
+          if(!inside(target))
+            goto stop;
+          tape[target] += i.arg * tape[cell];
+        }
+      break;
+      case InstructionType::SCAN:
+        for(;;cell += static_cast<int32_t>(i.extra)){
+          if(!inside(cell))
+            goto stop; // the JIT may find the zero in the guard, let it
+          if(!tape[cell])
+            break;
+        }
+        head = cell;
+      break;
+      case InstructionType::OUTPUT:
+        if(!inside(cell))
+          goto stop;
+        state.output.push_back(tape[cell]);
+      break;
+      case InstructionType::INPUT:
+        goto stop;
+      case InstructionType::BEQZ:
+        if(!inside(head))
+          goto stop;
+        if(!tape[head]){
+          pc = i.extra + 1;
+          steps++;
+          continue;
+        }
+      break;
+      case InstructionType::BNEQ:
+        if(!inside(head))
+          goto stop;
+        if(tape[head]){
+          pc = i.extra + 1;
+          steps++;
+          continue;
+        }
+      break;
+      default:
+      break;
+    }
+    pc++;
+    steps++;
+  }
+stop:
+  state.pc = pc;
+  state.head = head;
+  state.steps = steps;
+  state.finished = pc == instructions.size();
+  verbose(options, "Evaluated " + std::to_string(steps) + " instructions at compile time, " + std::to_string(state.output.size())
+                   + " bytes of output, " + (state.finished ? "the program ended." : "resuming at instruction " + std::to_string(pc) + "."));
+}
+
+instructions_list evalResidual(const instructions_list &instructions, uint64_t pc, std::vector<uint32_t> *loop_origins) {
+  std::vector<uint64_t> open; // BEQZ of every loop pc is in, outermost first
+  for(uint64_t k=0;k<pc;k++){
+    if(instructions[k].type!=InstructionType::BEQZ)
+      continue;
+    if(instructions[k].extra >= pc)
+      open.push_back(k);
+    else
+      k = instructions[k].extra; // over before pc
+  }
+
+  std::vector<uint64_t> loops; // BEQZ of every loop, the rank of a loop indexes loop_origins
+  std::vector<uint32_t> origins;
+  if(loop_origins)
+    for(uint64_t k=0;k<instructions.size();k++)
+      if(instructions[k].type==InstructionType::BEQZ)
+        loops.push_back(k);
+  instructions_list residual;
+  auto append = [&](uint64_t from, uint64_t to){
+    residual.insert(residual.end(), instructions.begin() + from, instructions.begin() + to);
+    if(!loop_origins)
+      return;
+    for(uint64_t k=from;k<to;k++)
+      if(instructions[k].type==InstructionType::BEQZ){
+        uint32_t rank = std::lower_bound(loops.begin(), loops.end(), k) - loops.begin();
+        origins.push_back(loop_origins->empty() ? rank : (*loop_origins)[rank]);
+      }
+  };
+
+  uint64_t k = pc;
+  for(auto loop = open.rbegin(); loop != open.rend(); loop++){
+    uint64_t end = instructions[*loop].extra;
+    append(k, end);        // the rest of the iteration running at pc
+    append(*loop, end+1);  // the iterations to come, the BEQZ tests the cell the BNEQ would have
+    k = end + 1;
+  }
+  append(k, instructions.size());
+  linkBranches(residual);
+  if(loop_origins)
+    loop_origins->swap(origins);
+  return residual;
+}
@@ -0,0 +1,44 @@
+#ifndef EVALUATOR_H
+#define EVALUATOR_H
+#include <iostream>
+#include <string>
+#include <vector>
+#include "utils.hpp"
+
+#define EVAL_JIT_BUDGET (1 << 20) // Instructions run at compile time by default before the JIT runs the rest, a few ms at most
+#define EVAL_ELF_BUDGET (1 << 26) // Same for an executable, built once and run many times, a fraction of a second at most
+
+/**
+ * @brief where the program stands after evalProgram, the run resumes from here.
+ */
+typedef struct{
+  uint64_t pc = 0;               // next instruction to run
+  int64_t head = 0;              // tape position, it may be out of the tape as long as no cell there was touched
+  std::vector<uint8_t> memory;   // the tape, max_memory cells
+  std::vector<uint8_t> output;   // bytes written so far
+  uint64_t steps = 0;            // instructions run
+  bool finished = false;         // the whole program ran, nothing is left to compile
+}eval_state_t;
+
+/**
+ * @brief runs the program at compile time, from the start, until it would read input.
+ * It stops before the first INPUT, after options.eval_budget instructions, or before an instruction touching a cell out
+ * of the tape, whose behaviour is left to the generated code. Cells, MUL guards and scans behave like in the JIT.
+ * @param instructions The program, branches must be linked (BEQZ and BNEQ hold the index of each other).
+ * @param options Compiler options, max_memory is the size of the tape.
+ * @param state Receives the output, the tape and the position reached.
+ */
+void evalProgram(const instructions_list &instructions, CompilerOptions &options, eval_state_t &state);
+
+/**
+ * @brief returns the program left to run from pc, with its branches linked.
+ * The rest of every loop pc is in is followed by a copy of that loop, for the iterations still to come,
+ * then by the code after it, so running it from the head of the state gives the same result as going on from pc.
+ * @param instructions The program evalProgram ran.
+ * @param pc The instruction it stopped at.
+ * @param loop_origins If not NULL, the origin of every loop of instructions, empty when each '[' is a loop,
+ * replaced by the origins of the loops of the result.
+ */
+instructions_list evalResidual(const instructions_list &instructions, uint64_t pc, std::vector<uint32_t> *loop_origins = NULL);
+
+#endif
@@ -0,0 +1,255 @@
+#include "interpreter.hpp"
+#include "jit.hpp"
+#include "stats.hpp"
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+
+typedef struct{
+  const void *handler; // code handling the instruction, the interpreter jumps straight to it
+  int32_t offset;      // cell the instruction works on, relative to the tape pointer
+  int32_t extra;       // count, stride, MUL target offset or index of the instruction to jump to
+  uint8_t arg;         // MUL factor
+  uint32_t count;      // times a BNEQ jumped back, the tiered mode compiles the loop when it reaches TIER_THRESHOLD
+}threaded_t;
+
+typedef void* (*fragment_fn)(void *pointer, jit_io_t *io);
+
+/**
+ * @brief a code buffer holding the loops compiled by the tiered mode, each one with its own JIT backend
+ * as the backend keeps the address of the I/O routines emitted at the start of its buffer.
+ */
+typedef struct{
+  jit_code_t *jit;
+  JITInterface *arch;
+  JIT_init_t init;
+}tier_arena_t;
+
+/**
+ * @brief opens a new arena big enough for size bytes of fragments and emits the shared routines.
+ * @return false if there is no JIT for this machine.
+ */
+static bool newArena(std::vector<tier_arena_t> &arenas, size_t size) {
+  tier_arena_t arena;
+  arena.arch = getJITArch(system_arch, &arena.init);
+  if(arena.arch == NULL)
+    return false;
+  size += arena.init.instructions_size[static_cast<uint8_t>(InstructionType::UNKNOWN)]; // room for the routines
+  arena.jit = create_JITCode(size > TIER_ARENA_SIZE ? size : TIER_ARENA_SIZE);
+  arena.arch->runtime(arena.jit);
+  arenas.push_back(arena);
+  return true;
+}
+
+/**
+ * @brief compiles the loop starting at begin into the last arena, opening a new one when it is full.
+ * The arena is writable only while the fragment is emitted.
+ */
+static fragment_fn tierCompile(std::vector<tier_arena_t> &arenas, const instructions_list &instructions,
+                               size_t begin, CompilerOptions options) {
+  size_t size = jitLoopSize(arenas.back().init, instructions, begin);
+  if(arenas.back().jit->code_size + size >= arenas.back().jit->memory_size)
+    newArena(arenas, size);
+  tier_arena_t &arena = arenas.back();
+  if(mprotect(arena.jit->code_buf, arena.jit->memory_size, PROT_READ | PROT_WRITE) != 0) {
+    std::cerr << "Error: Failed to make memory writable." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  size_t start = jitCompileLoop(arena.arch, arena.init, arena.jit, instructions, begin, options);
+  stats.code_estimate += size;
+  stats.code_bytes += arena.jit->code_size - start;
+  if(mprotect(arena.jit->code_buf, arena.jit->memory_size, PROT_READ | PROT_EXEC) != 0) {
+    std::cerr << "Error: Failed to make memory executable." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  return (fragment_fn)((char*)arena.jit->code_buf + start);
+}
+
+/**
+ * @brief writes the first size bytes of buffer to stdout, handling partial writes.
+ */
+static void flushOutput(uint8_t *buffer, size_t size) {
+  size_t written = 0;
+  while(written < size){
+    ssize_t n = write(STDOUT_FILENO, buffer + written, size - written);
+    if(n <= 0)
+      return;
+    written += n;
+  }
+}
+
+void interpret(const instructions_list &instructions, CompilerOptions options, const eval_state_t *snapshot) {
+  uint8_t *mem = (uint8_t*)calloc(options.max_memory + 2*JIT_TAPE_GUARD, sizeof(uint8_t));
+  jit_io_t *io = (jit_io_t*)malloc(sizeof(jit_io_t)); // shared with the compiled loops
+  std::vector<threaded_t> code(instructions.size() + 1);
+  if (mem == NULL || io == NULL) {
+    std::cerr << "Error: Memory allocation failed." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  uint8_t *out = io->out;
+  uint8_t *in = io->in;
+
+  std::vector<tier_arena_t> arenas;
+  std::vector<fragment_fn> natives; // compiled loops, indexed by the BEQZ they replace
+  bool tiered = options.tiered;
+  if(tiered){
+    getSystemArch();
+    tiered = newArena(arenas, 0);
+    if(!tiered)
+      verbose(options, "No JIT for this architecture, loops stay interpreted.");
+    natives.resize(instructions.size(), NULL);
+  }
+
+  const void *handlers[256] = {};
+  handlers[InstructionType::ADD] = &&op_add;
+  handlers[InstructionType::SUB] = &&op_sub;
+  handlers[InstructionType::INC] = &&op_inc;
+  handlers[InstructionType::DEC] = &&op_dec;
+  handlers[InstructionType::INPUT] = &&op_input;
+  handlers[InstructionType::OUTPUT] = &&op_output;
+  handlers[InstructionType::BEQZ] = &&op_beqz;
+  handlers[InstructionType::BNEQ] = tiered ? &&op_bneq_count : &&op_bneq;
+  handlers[InstructionType::MOV0] = &&op_mov0;
+  handlers[InstructionType::MUL] = &&op_mul;
+  handlers[InstructionType::SCAN] = &&op_scan;
+
+  for(size_t k=0;k<instructions.size();k++){
+    Instruction i = instructions[k];
+    code[k].handler = handlers[i.type] ? handlers[i.type] : &&op_skip;
+    code[k].offset = i.offset;
+    code[k].extra = static_cast<int32_t>(i.extra);
+    code[k].arg = i.arg;
+    code[k].count = 0;
+    if(i.type == InstructionType::ADD || i.type == InstructionType::SUB)
+      code[k].extra = static_cast<uint8_t>(i.extra);
+    else if(i.type == InstructionType::BEQZ || i.type == InstructionType::BNEQ)
+      code[k].extra = static_cast<int32_t>(i.extra) + 1; // both continue after the other end of the loop
+  }
+  code[instructions.size()].handler = &&op_end;
+  verbose(options, "Interpreting " + std::to_string(instructions.size()) + " instructions.");
+
+  uint8_t *tape = mem + JIT_TAPE_GUARD;
+  uint8_t *tape_end = tape + options.max_memory + JIT_TAPE_GUARD; // the zeroed guard stops scans
+  uint8_t *p = tape;
+  if(snapshot){
+    std::copy(snapshot->memory.begin(), snapshot->memory.end(), tape);
+    p = tape + snapshot->head;
+    flushOutput((uint8_t*)snapshot->output.data(), snapshot->output.size());
+  }
+  size_t out_size = 0;
+  size_t in_pos = 0, in_size = 0;
+  uint32_t compiled = 0;
+  threaded_t *i = code.data();
+
+  #define DISPATCH() goto *i->handler
+  #define NEXT() do { i++; DISPATCH(); } while(0)
+
+  DISPATCH();
+
+  op_add:
+    p[i->offset] += i->extra;
+    NEXT();
+  op_sub:
+    p[i->offset] -= i->extra;
+    NEXT();
+  op_inc:
+    p += i->extra;
+    NEXT();
+  op_dec:
+    p -= i->extra;
+    NEXT();
+  op_mov0:
+    p[i->offset] = 0;
+    NEXT();
+  op_mul:
+    // like the guard of the JIT, the target is not touched when the loop would not have run
+    if(p[i->offset])
+      p[i->offset + i->extra] += i->arg * p[i->offset];
+    NEXT();
+  op_scan:
+    if(i->extra == 1)
+      p = (uint8_t*)memchr(p, 0, tape_end - p);
+    else if(i->extra == -1)
+      p = (uint8_t*)memrchr(mem, 0, p - mem + 1);
+    else
+      while(*p)
+        p += i->extra;
+    NEXT();
+  op_beqz:
+    if(!*p){
+      i = code.data() + i->extra;
+      DISPATCH();
+    }
+    NEXT();
+  op_bneq:
+    if(*p){
+      i = code.data() + i->extra;
+      DISPATCH();
+    }
+    NEXT();
+  op_bneq_count:
+    if(*p){
+      if(++i->count == TIER_THRESHOLD){
+        // hot loop: compile it and run the remaining iterations natively, the entry test passes as the cell is not zero
+        size_t loop = i->extra - 1;
+        natives[loop] = tierCompile(arenas, instructions, loop, options);
+        code[loop].handler = &&op_native;
+        compiled++;
+        i = code.data() + loop;
+        DISPATCH();
+      }
+      i = code.data() + i->extra;
+      DISPATCH();
+    }
+    NEXT();
+  op_native:
+    // the loop is skipped by the fragment as well when the cell is zero
+    io->out_pos = out_size;
+    io->in_pos = in_pos;
+    io->in_end = in_size;
+    p = (uint8_t*)natives[i - code.data()](p, io);
+    out_size = io->out_pos;
+    in_pos = io->in_pos;
+    in_size = io->in_end;
+    i = code.data() + i->extra;
+    DISPATCH();
+  op_output:
+    out[out_size++] = p[i->offset];
+    if(out_size == INTERP_IO_BUFFER_SIZE){
+      flushOutput(out, out_size);
+      out_size = 0;
+    }
+    NEXT();
+  op_input:
+    if(in_pos == in_size){
+      // prompts must be visible before blocking
+      flushOutput(out, out_size);
+      out_size = 0;
+      ssize_t n = read(STDIN_FILENO, in, INTERP_IO_BUFFER_SIZE);
+      in_pos = 0;
+      in_size = n > 0 ? n : 0;
+      if(in_size == 0) // EOF, the cell is left unchanged
+        NEXT();
+    }
+    p[i->offset] = in[in_pos++];
+    NEXT();
+  op_skip:
+    NEXT();
+  op_end:
+    flushOutput(out, out_size);
+
+  #undef NEXT
+  #undef DISPATCH
+
+  if(tiered)
+    verbose(options, std::to_string(compiled) + " hot loops compiled in " + std::to_string(arenas.size()) + " code buffers.");
+  verbose(options, "Interpretation completed successfully.");
+  for(tier_arena_t &arena : arenas){
+    munmap(arena.jit->code_buf, arena.jit->memory_size);
+    free(arena.jit);
+    delete arena.arch;
+  }
+  free(io);
+  free(mem);
+}
@@ -0,0 +1,28 @@
+#ifndef INTERPRETER_H
+#define INTERPRETER_H
+#include <iostream>
+#include <vector>
+#include "utils.hpp"
+#include "evaluator.hpp"
+
+#define INTERP_IO_BUFFER_SIZE JIT_IO_BUFFER_SIZE // Size of the stdin/stdout buffers, the interpreter flushes like the JIT does
+#define TIER_THRESHOLD 1000                       // Back jumps after which the tiered mode compiles a loop
+#define TIER_ARENA_SIZE (1 << 20)                 // Size of each code buffer holding compiled loops
+
+/**
+ * @brief runs the program with a direct-threaded interpreter.
+ * The instructions are first translated to an array holding, for each one, the address of the code handling it
+ * (GCC computed goto) and its operands, with branches resolved to their target, so dispatching the next instruction is
+ * a single indirect jump. It runs the optimized IR, MOV0, MUL and SCAN included, on any architecture the compiler builds on,
+ * and it is the engine used when there is no JIT for the host. Output is identical to the JIT: same guarded tape,
+ * same buffered I/O and a cell left unchanged at the end of the input.
+ * With options.tiered every BNEQ counts its back jumps: once a loop reaches TIER_THRESHOLD it is compiled on its own
+ * by the JIT backend and its BEQZ is patched to call the native code, that shares the tape and the I/O buffers,
+ * so short programs and cold code never pay for compilation.
+ * @param instructions The program, branches must be linked (BEQZ and BNEQ hold the index of each other).
+ * @param options Compiler options, max_memory is the size of the tape.
+ * @param snapshot If not NULL, the output is written and the run starts on its tape, see partial evaluation.
+ */
+void interpret(const instructions_list &instructions, CompilerOptions options, const eval_state_t *snapshot = NULL);
+
+#endif
@@ -0,0 +1,344 @@
+#include "jit.hpp"
+#include "stats.hpp"
+#include <stack>
+#include <algorithm>
+
+#define INT32_S 4
+
+/**
+ * @brief picks the cells an innermost loop can keep in registers.
+ * Only loops whose body has no nested loop, scan or pointer move qualify: the tape pointer is then the same for the whole loop.
+ * Only cells the body touches on every iteration are candidates, the targets of a mul sequence are skipped by its guard,
+ * and loading them could read outside of the tape.
+ * @return the offsets to cache, the loop cell first and then the most used ones, empty if the loop does not qualify.
+ */
+static std::vector<int32_t> loopCache(const instructions_list &instructions, size_t branch_address, uint8_t registers) {
+  std::map<int32_t,uint32_t> uses; // offset -> instructions working on it
+  uses[0] = 0;
+  size_t end = instructions[branch_address].extra; // the matching BNEQ, linked by the passes
+  if(registers == 0)
+    return {};
+  for(size_t k=branch_address+1;k<end;k++){
+    Instruction i = instructions[k];
+    switch(i.type){
+      case InstructionType::ADD:
+      case InstructionType::SUB:
+      case InstructionType::MOV0:
+      case InstructionType::INPUT:
+      case InstructionType::OUTPUT:
+      case InstructionType::MUL:
+        uses[i.offset]++;
+      break;
+      default:
+        return {};
+    }
+  }
+  for(size_t k=branch_address+1;k<end;k++){
+    Instruction i = instructions[k];
+    auto target = uses.find(i.offset+static_cast<int32_t>(i.extra));
+    if(i.type==InstructionType::MUL && target!=uses.end())
+      target->second++;
+  }
+
+  std::vector<std::pair<uint32_t,int32_t>> ranked; // (uses, offset) of everything but the loop cell
+  for(auto &pair : uses)
+    if(pair.first != 0)
+      ranked.push_back({pair.second, pair.first});
+  std::stable_sort(ranked.begin(), ranked.end(), [](auto &a, auto &b){ return a.first > b.first; });
+  std::vector<int32_t> offsets = {0};
+  for(size_t r=0;r<ranked.size() && offsets.size()<registers;r++)
+    offsets.push_back(ranked[r].second);
+  return offsets;
+}
+
+typedef struct{
+  uint32_t address; // code offset right after the beqz, its jump address is the last field before it
+  size_t owner;     // the instruction the branch belongs to, the BEQZ of a loop or the first MUL of a sequence
+}jit_branch_t;
+
+typedef enum{
+  JIT_EMIT_PROGRAM,   // proStart, the code, proEnd
+  JIT_EMIT_FRAGMENT,  // fragmentStart, the code, fragmentEnd
+  JIT_EMIT_STUBS,     // like JIT_EMIT_PROGRAM, with a stub in place of every top level loop
+  JIT_EMIT_BODY       // the code alone, for the loop of a stub
+}jit_emit_t;
+
+/**
+ * @brief emits the instructions in [begin, end) at the end of jit, the whole program or a single loop.
+ * The branches owned by the instructions marked in long_branch (indexed from begin) use the long encoding, all the others the short one.
+ * @param mode What wraps the code and whether loops are emitted or left to stubs.
+ * @param stubs With JIT_EMIT_STUBS, receives the stubs by the offset they return to.
+ * @param profile If not NULL and instrumenting, every loop counts its entries and iterations in it.
+ * With the heat of --profile-use, cold loops keep their cells on the tape and hot innermost ones are aligned and unrolled twice.
+ * @param addresses If not NULL, receives the code offset of the instructions, at least of the top level ones, and of end.
+ * @return false if a short branch turned out to be too far, its owner is then marked in long_branch
+ * and the code has to be emitted again. Marks only grow, so this ends after a few rounds.
+ */
+static bool jitEmit(JITInterface *arch, JIT_init_t &init, jit_code_t *jit, const instructions_list &instructions,
+                    size_t begin, size_t end, jit_emit_t mode, CompilerOptions options, std::vector<bool> &long_branch,
+                    std::map<uint32_t,jit_stub_t> *stubs = NULL, profile_t *profile = NULL,
+                    std::vector<uint32_t> *addresses = NULL) {
+  bool fits = true;
+  // patches the jump address of the beqz at branch so it lands on target
+  auto patch = [&](jit_branch_t branch, size_t target) {
+    int32_t jump_distance = static_cast<int32_t>(target - branch.address);
+    if(long_branch[branch.owner-begin]){
+      memcpy((char*)jit->code_buf + branch.address-init.branch_address_size, &jump_distance, INT32_S);
+    }
+    else if(jump_distance > INT8_MAX){
+      long_branch[branch.owner-begin] = true;
+      fits = false;
+    }
+    else{
+      int8_t short_distance = static_cast<int8_t>(jump_distance);
+      memcpy((char*)jit->code_buf + branch.address-init.short_branch_address_size, &short_distance, 1);
+    }
+  };
+
+  uint64_t pc = begin;
+  std::stack<jit_branch_t> branch_stack; // Stack to handle branches
+  bool cached = false;      // inside an innermost loop keeping its cells in registers
+  uint32_t loop_start = 0;  // where the bneq of the cached loop jumps back, after the loads
+  bool unroll = false;      // the cached loop is hot, its body is emitted a second time
+  jit_branch_t middle = {0, 0}; // exit between the two copies of an unrolled body, it jumps to the stores
+  if(mode == JIT_EMIT_FRAGMENT)
+    arch->fragmentStart(jit);
+  else if(mode != JIT_EMIT_BODY)
+    arch->proStart(jit);
+  for(;pc<end;pc++){
+    Instruction instruction = instructions[pc];
+    if(addresses)
+      (*addresses)[pc] = jit->code_size;
+    if(!options.breakpoints.empty() && options.breakpoints.count(pc))
+      arch->breakpoint(jit,pc); // --break
+    switch(instruction.type){
+      case InstructionType::ADD:
+        arch->add(jit,instruction.extra,instruction.offset);
+      break;
+      case InstructionType::SUB:
+        arch->sub(jit,instruction.extra,instruction.offset);
+        break;
+      case InstructionType::INC:
+        arch->inc(jit,instruction.extra);
+      break;
+      case InstructionType::DEC:
+        arch->dec(jit,instruction.extra);
+      break;
+      case InstructionType::INPUT:
+        arch->input(jit,instruction.offset);
+      break;
+      case InstructionType::OUTPUT:
+        arch->output(jit,instruction.offset);
+      break;
+      case InstructionType::MOV0:
+        arch->mov0(jit,instruction.offset);
+        if(pc>begin && instructions[pc-1].type==InstructionType::MUL){
+          // close the guard of the multiply loop
+          patch(branch_stack.top(), jit->code_size);
+          branch_stack.pop();
+        }
+      break;
+      case InstructionType::BREAK:
+        arch->breakpoint(jit,pc);
+      break;
+      case InstructionType::SCAN:
+        arch->scan(jit,static_cast<int32_t>(instruction.extra));
+      break;
+      case InstructionType::MUL:
+        if(pc==begin || instructions[pc-1].type!=InstructionType::MUL){
+          // the loop body only ran when the cell was not zero, targets can be out of the tape otherwise
+          arch->beqz(jit,instruction.offset,!long_branch[pc-begin]);
+          branch_stack.push({static_cast<uint32_t>(jit->code_size), pc});
+        }
+        arch->mul(jit,instruction.offset,instruction.offset+static_cast<int32_t>(instruction.extra),instruction.arg);
+      break;
+      case InstructionType::BEQZ:{
+        // the entry of a lazy loop is counted in front of its stub, not again at the start of its body
+        if(profile && profile->instrument && !(mode == JIT_EMIT_BODY && pc == begin))
+          arch->counter(jit, &profileCounter(*profile, pc)->entries);
+        if(mode == JIT_EMIT_STUBS){
+          // the loop is compiled when the stub is first reached, loops skipped by their entry test never are
+          arch->beqz(jit,0,!long_branch[pc-begin]);
+          jit_branch_t branch = {static_cast<uint32_t>(jit->code_size), pc};
+          uint32_t stub = jit->code_size;
+          arch->lazyStub(jit);
+          (*stubs)[jit->code_size] = {stub, pc};
+          patch(branch, jit->code_size);
+          pc = instruction.extra;
+          break;
+        }
+        arch->beqz(jit,0,!long_branch[pc-begin]);
+        branch_stack.push({static_cast<uint32_t>(jit->code_size), pc});
+        loop_start = jit->code_size;
+        std::vector<int32_t> offsets;
+        uint8_t heat = profileHeat(profile, pc);
+        // a breakpoint must find the cells on the tape, a loop that never ran is not worth the loads and stores
+        if(options.optimize && options.breakpoints.empty() && heat != LOOP_COLD)
+          offsets = loopCache(instructions, pc, init.cache_registers);
+        if(!offsets.empty()){
+          arch->cacheLoad(jit, offsets.data(), static_cast<uint8_t>(offsets.size()));
+          cached = true;
+          unroll = heat == LOOP_HOT;
+          if(unroll)
+            arch->align(jit, 32); // the padding runs once, the back branch lands on a fresh fetch block
+          loop_start = jit->code_size;
+        }
+      }
+      break;
+      case InstructionType::BNEQ:
+        jit_branch_t branch = branch_stack.top();
+        if(profile && profile->instrument)
+          arch->counter(jit, &profileCounter(*profile, branch.owner)->iterations);
+        if(unroll){
+          // end of the first copy: leave through the stores if the cell is zero, or run the body again
+          arch->beqz(jit,0,!long_branch[branch.owner-begin]);
+          middle = {static_cast<uint32_t>(jit->code_size), branch.owner};
+          unroll = false;
+          pc = branch.owner;
+          break;
+        }
+        branch_stack.pop();
+        if(!cached)
+          loop_start = branch.address;
+        arch->bneq(jit,loop_start,!long_branch[branch.owner-begin]);
+        if(!long_branch[branch.owner-begin] && jit->code_size - loop_start > 128){
+          long_branch[branch.owner-begin] = true;
+          fits = false;
+        }
+        if(cached){
+          if(middle.address != 0){
+            patch(middle, jit->code_size);
+            middle = {0, 0};
+          }
+          arch->cacheStore(jit); // the exit of the loop, beqz skips the loads and jumps after the stores
+          cached = false;
+        }
+        patch(branch, jit->code_size); // Patch the jump distance
+      break; 
+    }
+  }
+  if(addresses)
+    (*addresses)[end] = jit->code_size;
+  if(mode == JIT_EMIT_FRAGMENT)
+    arch->fragmentEnd(jit);
+  else if(mode != JIT_EMIT_BODY)
+    arch->proEnd(jit);
+  return fits;
+}
+
+/**
+ * @brief returns an upper bound of the code of the whole program, from the number of each instruction type.
+ */
+static size_t jitProgramSize(JIT_init_t &init, std::map<InstructionType,uint32_t> &instructions_map) {
+  size_t jitSize=0;
+  for(auto &pair : instructions_map) {
+    
+    jitSize += pair.second * init.instructions_size[static_cast<uint8_t>(pair.first)]; 
+  }
+  jitSize+= init.instructions_size[static_cast<uint8_t>(InstructionType::UNKNOWN)]; // Add size for proStart and proEnd
+  return jitSize;
+}
+
+/**
+ * @brief returns the code the hot loops of --profile-use add to the estimate, a second body and the alignment padding each.
+ */
+static size_t jitHeatSize(JIT_init_t &init, const instructions_list &instructions, const profile_t *profile) {
+  size_t size = 0;
+  if(profile == NULL)
+    return 0;
+  for(size_t l=0;l<profile->heat.size();l++)
+    if(profile->heat[l] == LOOP_HOT)
+      size += jitLoopSize(init, instructions, profile->loops[l]);
+  return size;
+}
+
+jit_code_t* jitCompile(JITInterface *arch, JIT_init_t &init, const instructions_list &instructions,
+                              CompilerOptions options, std::map<InstructionType,uint32_t> &instructions_map, profile_t *profile,
+                       std::vector<uint32_t> *addresses) {
+  size_t jitSize = jitProgramSize(init, instructions_map) + jitHeatSize(init, instructions, profile);
+  verbose(options, "JIT code size: " + std::to_string(jitSize) + " bytes.");
+
+  jit_code_t*jit = create_JITCode(jitSize);
+  // every branch starts short, the ones that do not fit are switched to long and the program emitted again
+  std::vector<bool> long_branch(instructions.size(), init.short_branch_address_size == 0);
+  if(addresses)
+    addresses->resize(instructions.size() + 1);
+  int rounds = 1;
+  while(!jitEmit(arch, init, jit, instructions, 0, instructions.size(), JIT_EMIT_PROGRAM, options, long_branch, NULL, profile, addresses)){
+    jit->code_size = 0;
+    rounds++;
+  }
+  verbose(options, "Branches relaxed in " + std::to_string(rounds) + " rounds, " + std::to_string(jit->code_size) + " bytes of code.");
+  stats.code_estimate += jitSize;
+  stats.code_bytes += jit->code_size;
+  return jit;
+}
+
+size_t jitLoopSize(JIT_init_t &init, const instructions_list &instructions, size_t begin) {
+  size_t size = init.instructions_size[static_cast<uint8_t>(InstructionType::UNKNOWN)]; // covers fragmentStart and fragmentEnd
+  for(size_t k=begin;k<=instructions[begin].extra;k++)
+    size += init.instructions_size[static_cast<uint8_t>(instructions[k].type)];
+  return size;
+}
+
+size_t jitCompileLoop(JITInterface *arch, JIT_init_t &init, jit_code_t *jit, const instructions_list &instructions,
+                      size_t begin, CompilerOptions options) {
+  size_t start = jit->code_size;
+  size_t end = instructions[begin].extra + 1;
+  std::vector<bool> long_branch(end - begin, init.short_branch_address_size == 0);
+  while(!jitEmit(arch, init, jit, instructions, begin, end, JIT_EMIT_FRAGMENT, options, long_branch))
+    jit->code_size = start;
+  verbose(options, "Loop at " + std::to_string(begin) + " compiled, " + std::to_string(jit->code_size - start) + " bytes of code.");
+  return start;
+}
+
+/**
+ * @brief called by the stubs through the lazyRuntime routine: compiles the loop of the stub returning to return_address
+ * at the end of the buffer, followed by a jump back after the stub, and patches the stub to jump to it.
+ * @return the address of the loop.
+ */
+static const void* lazyResolve(jit_lazy_t *lazy, const uint8_t *return_address) {
+  jit_code_t *jit = lazy->jit;
+  uint32_t back = static_cast<uint32_t>(return_address - (const uint8_t*)jit->code_buf);
+  jit_stub_t stub = lazy->stubs[back];
+  size_t body = jit->code_size;
+  size_t end = (*lazy->instructions)[stub.begin].extra + 1;
+  std::vector<bool> long_branch(end - stub.begin, lazy->init->short_branch_address_size == 0);
+  while(!jitEmit(lazy->arch, *lazy->init, jit, *lazy->instructions, stub.begin, end, JIT_EMIT_BODY, lazy->options, long_branch, NULL, lazy->profile))
+    jit->code_size = body;
+  lazy->arch->jump(jit, back);
+  lazy->bodies[stub.begin] = {static_cast<uint32_t>(body), static_cast<uint32_t>(jit->code_size - body)};
+
+  // the stub becomes a jump to the loop, later entries do not leave the code
+  size_t code_size = jit->code_size;
+  jit->code_size = stub.start;
+  lazy->arch->jump(jit, body);
+  jit->code_size = code_size;
+  lazy->compiled++;
+  verbose(lazy->options, "Loop at " + std::to_string(stub.begin) + " compiled on first entry, " + std::to_string(jit->code_size - body) + " bytes of code.");
+  return (const uint8_t*)jit->code_buf + body;
+}
+
+size_t jitCompileLazy(jit_lazy_t &lazy, std::map<InstructionType,uint32_t> &instructions_map) {
+  JIT_init_t &init = *lazy.init;
+  // the mapping is only reserved, pages are committed as loops get compiled into them.
+  // It stays writable while the program runs: switching the protection for every loop costs more than compiling it
+  size_t jitSize = jitProgramSize(init, instructions_map)
+                 + instructions_map[InstructionType::BEQZ] * init.instructions_size[static_cast<uint8_t>(InstructionType::BEQZ)] // stubs and jumps back
+                 + jitHeatSize(init, *lazy.instructions, lazy.profile);
+  lazy.jit = create_JITCode(jitSize);
+  stats.code_estimate += jitSize; // the bytes are counted once the program ran and its loops got compiled
+  lazy.compiled = 0;
+  lazy.arch->lazyRuntime(lazy.jit, &lazy, (const void*)lazyResolve);
+
+  size_t entry = lazy.jit->code_size;
+  std::vector<bool> long_branch(lazy.instructions->size(), init.short_branch_address_size == 0);
+  if(lazy.addresses)
+    lazy.addresses->resize(lazy.instructions->size() + 1);
+  while(!jitEmit(lazy.arch, init, lazy.jit, *lazy.instructions, 0, lazy.instructions->size(), JIT_EMIT_STUBS, lazy.options, long_branch, &lazy.stubs, lazy.profile, lazy.addresses)){
+    lazy.jit->code_size = entry;
+    lazy.stubs.clear();
+  }
+  verbose(lazy.options, std::to_string(lazy.stubs.size()) + " top level loops left to stubs, " + std::to_string(lazy.jit->code_size) + " bytes of code.");
+  return entry;
+}
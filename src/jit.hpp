@@ -0,0 +1,70 @@
+#ifndef JIT_H
+#define JIT_H
+#include <iostream>
+#include <vector>
+#include <map>
+#include "utils.hpp"
+#include "profile.hpp"
+
+typedef struct{
+  uint32_t start;   // offset of the stub, overwritten by a jump to the loop once compiled
+  size_t begin;     // index of the BEQZ of the loop
+}jit_stub_t;
+
+typedef struct{
+  uint32_t start;   // offset in the code buffer
+  uint32_t size;
+}jit_range_t;
+
+/**
+ * @brief the state of a lazily compiled program, handed to the stubs.
+ */
+typedef struct{
+  JITInterface *arch;
+  JIT_init_t *init;
+  jit_code_t *jit;
+  const instructions_list *instructions;
+  CompilerOptions options;
+  std::map<uint32_t,jit_stub_t> stubs;  // stubs by the offset they return to
+  uint32_t compiled;                    // loops compiled so far
+  profile_t *profile;                   // counters of --profile and heat of --profile-use, NULL without either
+  std::vector<uint32_t> *addresses;     // code offset of every top level instruction, NULL when not needed
+  std::map<uint32_t,jit_range_t> bodies;  // code of every loop compiled so far, by its BEQZ
+}jit_lazy_t;
+
+/**
+ * @brief sizes the code buffer on instructions_map and emits the program, relaxing the branches.
+ * @param profile If not NULL, every loop counts its entries and iterations in it when instrumenting, and is compiled after its heat.
+ * @param addresses If not NULL, receives the code offset of every top level instruction, and of the end of the program
+ * at instructions.size(), for the symbols of --perf-map.
+ * @return the code, starting with the program itself at offset 0.
+ */
+jit_code_t* jitCompile(JITInterface *arch, JIT_init_t &init, const instructions_list &instructions,
+                       CompilerOptions options, std::map<InstructionType,uint32_t> &instructions_map, profile_t *profile = NULL,
+                       std::vector<uint32_t> *addresses = NULL);
+
+/**
+ * @brief returns an upper bound of the code jitCompileLoop emits for the loop starting at begin.
+ */
+size_t jitLoopSize(JIT_init_t &init, const instructions_list &instructions, size_t begin);
+
+/**
+ * @brief emits the loop starting at begin as a fragment at the end of jit, relaxing its branches.
+ * The fragment is called as void*(void *pointer, jit_io_t *io): it runs the loop from its entry test, inner loops included,
+ * and returns the tape pointer once it exits. The routines of arch->runtime must already be in jit.
+ * @param begin Index of the BEQZ of the loop, branches must be linked.
+ * @return the offset of the fragment in jit.
+ */
+size_t jitCompileLoop(JITInterface *arch, JIT_init_t &init, jit_code_t *jit, const instructions_list &instructions,
+                      size_t begin, CompilerOptions options);
+
+/**
+ * @brief emits the program with every top level loop replaced by a stub, a loop is only compiled the first time its stub runs.
+ * The body is appended to the buffer and the stub patched to jump to it, so start up time and resident code
+ * grow with the loops actually run instead of the size of the program.
+ * @param lazy The arch, init, instructions and options to use, jit and stubs are filled in. It must outlive the run.
+ * @return the offset of the entry point of the program in lazy.jit, the runtime of the stubs comes first.
+ */
+size_t jitCompileLazy(jit_lazy_t &lazy, std::map<InstructionType,uint32_t> &instructions_map);
+
+#endif
@@ -1,72 +1,239 @@
 #ifndef X86JIT_H
 #define X86JIT_H
 #include "../JIT_arch_iterface.hpp"
+#include <elf.h>
+#include <cstddef>
 
 #define BRANCH_ADDRESS_SIZE 4
+#define SHORT_BRANCH_ADDRESS_SIZE 1
+#define CACHE_REGISTERS 4                           // r8b-r11b hold the cached cells of a loop
+#define CACHE_SPILL_SIZE (CACHE_REGISTERS*8)        // mov between a register and [rsi+disp32] for every cached cell
 
 class X86JIT:public JITInterface {
   public:
     X86JIT(JIT_init_t *init){
-      init->instructions_size[static_cast<uint8_t>(InstructionType::ADD)] = 3;
-      init->instructions_size[static_cast<uint8_t>(InstructionType::SUB)] = 3;
+      init->instructions_size[static_cast<uint8_t>(InstructionType::ADD)] = 7;
+      init->instructions_size[static_cast<uint8_t>(InstructionType::SUB)] = 7;
       init->instructions_size[static_cast<uint8_t>(InstructionType::INC)] = 7;
       init->instructions_size[static_cast<uint8_t>(InstructionType::DEC)] = 7;
-      init->instructions_size[static_cast<uint8_t>(InstructionType::INPUT)] = 12;
-      init->instructions_size[static_cast<uint8_t>(InstructionType::OUTPUT)] = 12;
-      init->instructions_size[static_cast<uint8_t>(InstructionType::BEQZ)] = 10;
-      init->instructions_size[static_cast<uint8_t>(InstructionType::BNEQ)] = 10;
-      init->instructions_size[static_cast<uint8_t>(InstructionType::UNKNOWN)] = 9+1; // Unknown keeps size of prostart and proend, +1 because it is used to store the address of the next instruction
+      init->instructions_size[static_cast<uint8_t>(InstructionType::INPUT)] = 26+2*CACHE_SPILL_SIZE; // the cache is written back and reloaded around I/O
+      init->instructions_size[static_cast<uint8_t>(InstructionType::OUTPUT)] = 21+2*CACHE_SPILL_SIZE;
+      init->instructions_size[static_cast<uint8_t>(InstructionType::BEQZ)] = 13+CACHE_SPILL_SIZE+13; // + cacheLoad + counter
+      init->instructions_size[static_cast<uint8_t>(InstructionType::BNEQ)] = 13+CACHE_SPILL_SIZE+13; // + cacheStore + counter
+      init->instructions_size[static_cast<uint8_t>(InstructionType::MOV0)] = 7;
+      init->instructions_size[static_cast<uint8_t>(InstructionType::MUL)] = 16+13; // +13 for the beqz guarding the multiply loop
+      init->instructions_size[static_cast<uint8_t>(InstructionType::UNKNOWN)] = 118+15+59+35+1; // Unknown keeps size of prostart, proend, elfEntry and lazyRuntime, +1 because it is used to store the address of the next instruction
+      init->instructions_size[static_cast<uint8_t>(InstructionType::SCAN)] = 40;
+      init->instructions_size[static_cast<uint8_t>(InstructionType::BREAK)] = 12+5+46; // + flush and fragmentEnd
       init->branch_address_size =BRANCH_ADDRESS_SIZE;
+      init->short_branch_address_size = SHORT_BRANCH_ADDRESS_SIZE;
+      init->cache_registers = CACHE_REGISTERS;
+      init->elf_machine = EM_X86_64;
+      vector_width = __builtin_cpu_supports("avx2") ? 32 : 16;
     }
     inline void proStart(jit_code_t *jit) override{
-      check_size(jit, 8);
-      memcpy((char*)jit->code_buf + jit->code_size, 
-        "\x48\x89\xFE"                          // mov rsi,rdi; move memory pointer to rsi
-        "\xBF\x01\x00\x00\x00", 8);             // mov edi, 1; (signle byte) for optimisation purposes during read and write from and to stdout
-      jit->code_size += 8;
+      check_size(jit, 118);
+      memcpy((char*)jit->code_buf + jit->code_size,
+        "\xEB\x54",2);                          // jmp entry; skip the out-of-line I/O routines
+      jit->code_size += 2;
+      runtime(jit);
+      memcpy((char*)jit->code_buf + jit->code_size,
+        // entry: save callee-saved registers and set up the I/O cursors
+        "\x53"                                  // push rbx
+        "\x41\x54"                              // push r12
+        "\x41\x55"                              // push r13
+        "\x41\x56"                              // push r14
+        "\x41\x57"                              // push r15
+        "\x49\x89\xF4"                          // mov r12, rsi; jit_io_t out buffer
+        "\x48\x89\xFE"                          // mov rsi, rdi; move memory pointer to rsi
+        "\x4D\x8D\xAC\x24\x00\x00\x00\x00"      // lea r13, [r12+JIT_IO_BUFFER_SIZE]; jit_io_t in buffer
+        "\x4C\x89\xE3"                          // mov rbx, r12; output cursor
+        "\x4D\x89\xEE"                          // mov r14, r13; input cursor
+        "\x4D\x89\xEF", 32);                    // mov r15, r13; input end
+      uint32_t buffer_size = JIT_IO_BUFFER_SIZE;
+      memcpy((char*)jit->code_buf + jit->code_size + 0x13, &buffer_size, 4);
+      jit->code_size += 32;
     };
-    
+
+    inline void runtime(jit_code_t *jit) override{
+      check_size(jit, 84);
+      size_t start = jit->code_size;
+      memcpy((char*)jit->code_buf + jit->code_size,
+        // flush_out: write [r12, rbx) to stdout, then reset rbx to r12
+        "\x56"                                  // push rsi; preserve tape pointer
+        "\x48\x89\xDA"                          // mov rdx, rbx
+        "\x4C\x29\xE2"                          // sub rdx, r12; number of pending bytes
+        "\x4C\x89\xE6"                          // mov rsi, r12; buffer start
+        "\x48\x85\xD2"                          // test rdx, rdx
+        "\x74\x19"                              // je done
+        "\xB8\x01\x00\x00\x00"                  // mov eax, 1; (sys_write)
+        "\xBF\x01\x00\x00\x00"                  // mov edi, 1; stdout file descriptor
+        "\x0F\x05"                              // syscall
+        "\x48\x85\xC0"                          // test rax, rax
+        "\x7E\x08"                              // jle done; give up on error
+        "\x48\x01\xC6"                          // add rsi, rax; handle partial writes to pipes
+        "\x48\x29\xC2"                          // sub rdx, rax
+        "\xEB\xE2"                              // jmp test rdx
+        "\x4C\x89\xE3"                          // done: mov rbx, r12; empty buffer
+        "\x5E"                                  // pop rsi
+        "\xC3"                                  // ret
+        // fill_in: flush stdout, refill [r13, r15) from stdin, eax = 0 on EOF
+        "\xE8\xCE\xFF\xFF\xFF"                  // call flush_out; prompts must be visible before blocking
+        "\x56"                                  // push rsi
+        "\x4C\x89\xEE"                          // mov rsi, r13; input buffer start
+        "\x31\xFF"                              // xor edi, edi; stdin file descriptor
+        "\xBA\x00\x00\x00\x00"                  // mov edx, JIT_IO_BUFFER_SIZE
+        "\x31\xC0"                              // xor eax, eax; (sys_read)
+        "\x0F\x05"                              // syscall
+        "\x5E"                                  // pop rsi
+        "\x4D\x89\xEE"                          // mov r14, r13
+        "\x4D\x89\xEF"                          // mov r15, r13
+        "\x48\x85\xC0"                          // test rax, rax
+        "\x7E\x04"                              // jle eof
+        "\x49\x01\xC7"                          // add r15, rax; end of valid input
+        "\xC3"                                  // ret
+        "\x31\xC0"                              // eof: xor eax, eax
+        "\xC3", 84);                             // ret
+      uint32_t buffer_size = JIT_IO_BUFFER_SIZE;
+      memcpy((char*)jit->code_buf + start + 0x39, &buffer_size, 4);
+      flush_address = start;
+      fill_address = start + 0x2D;
+      jit->code_size += 84;
+    };
+
+    inline void fragmentStart(jit_code_t *jit) override{
+      check_size(jit, 56);
+      memcpy((char*)jit->code_buf + jit->code_size,
+        "\x53"                                  // push rbx
+        "\x41\x54"                              // push r12
+        "\x41\x55"                              // push r13
+        "\x41\x56"                              // push r14
+        "\x41\x57"                              // push r15
+        "\x49\x89\xF4"                          // mov r12, rsi; jit_io_t out buffer
+        "\x48\x89\xFE"                          // mov rsi, rdi; tape pointer
+        "\x4D\x8D\xAC\x24\x00\x00\x00\x00"      // lea r13, [r12+JIT_IO_BUFFER_SIZE]; jit_io_t in buffer
+        "\x49\x8B\x9C\x24\x00\x00\x00\x00"      // mov rbx, [r12+out_pos]
+        "\x4C\x01\xE3"                          // add rbx, r12; output cursor
+        "\x4D\x8B\xB4\x24\x00\x00\x00\x00"      // mov r14, [r12+in_pos]
+        "\x4D\x01\xEE"                          // add r14, r13; input cursor
+        "\x4D\x8B\xBC\x24\x00\x00\x00\x00"      // mov r15, [r12+in_end]
+        "\x4D\x01\xEF", 56);                    // add r15, r13; input end
+      uint32_t fields[4] = {JIT_IO_BUFFER_SIZE, offsetof(jit_io_t, out_pos), offsetof(jit_io_t, in_pos), offsetof(jit_io_t, in_end)};
+      memcpy((char*)jit->code_buf + jit->code_size + 0x13, &fields[0], 4);
+      memcpy((char*)jit->code_buf + jit->code_size + 0x1B, &fields[1], 4);
+      memcpy((char*)jit->code_buf + jit->code_size + 0x26, &fields[2], 4);
+      memcpy((char*)jit->code_buf + jit->code_size + 0x31, &fields[3], 4);
+      jit->code_size += 56;
+    };
+
+    inline void fragmentEnd(jit_code_t *jit) override{
+      check_size(jit, 46);
+      memcpy((char*)jit->code_buf + jit->code_size,
+        "\x4C\x29\xE3"                          // sub rbx, r12
+        "\x49\x89\x9C\x24\x00\x00\x00\x00"      // mov [r12+out_pos], rbx
+        "\x4D\x29\xEE"                          // sub r14, r13
+        "\x4D\x89\xB4\x24\x00\x00\x00\x00"      // mov [r12+in_pos], r14
+        "\x4D\x29\xEF"                          // sub r15, r13
+        "\x4D\x89\xBC\x24\x00\x00\x00\x00"      // mov [r12+in_end], r15
+        "\x48\x89\xF0"                          // mov rax, rsi; return the tape pointer
+        "\x41\x5F"                              // pop r15
+        "\x41\x5E"                              // pop r14
+        "\x41\x5D"                              // pop r13
+        "\x41\x5C"                              // pop r12
+        "\x5B"                                  // pop rbx
+        "\xC3", 46);                             // ret
+      uint32_t fields[3] = {offsetof(jit_io_t, out_pos), offsetof(jit_io_t, in_pos), offsetof(jit_io_t, in_end)};
+      memcpy((char*)jit->code_buf + jit->code_size + 0x07, &fields[0], 4);
+      memcpy((char*)jit->code_buf + jit->code_size + 0x12, &fields[1], 4);
+      memcpy((char*)jit->code_buf + jit->code_size + 0x1D, &fields[2], 4);
+      jit->code_size += 46;
+    };
+
     inline void proEnd(jit_code_t *jit)override{
-      check_size(jit, 1);
+      check_size(jit, 15);
+      call(jit, flush_address);                   // call flush_out; write what is left in the buffer
       memcpy((char*)jit->code_buf + jit->code_size, 
-              "\xC3",1);                   // ret           
-      jit->code_size += 1;
+              "\x41\x5F"                         // pop r15
+              "\x41\x5E"                         // pop r14
+              "\x41\x5D"                         // pop r13
+              "\x41\x5C"                         // pop r12
+              "\x5B"                             // pop rbx
+              "\xC3",10);                        // ret           
+      jit->code_size += 10;
     };
     
-    inline void add(jit_code_t *jit,uint8_t count)override{
-      check_size(jit, 3);
+    inline void add(jit_code_t *jit,uint8_t count,int32_t offset)override{
+      check_size(jit, 7);
+      int8_t slot = cacheSlot(offset);
+      if(slot >= 0){
+        uint8_t code[4] = {0x41, 0x80, static_cast<uint8_t>(0xC0 | slot), count}; // add r8b+slot, count
+        memcpy((char*)jit->code_buf + jit->code_size, code, 4);
+        jit->code_size += 4;
+        return;
+      }
       memcpy((char*)jit->code_buf + jit->code_size, 
-              "\x80\x06",2);                       
-      memcpy((char*)jit->code_buf+jit->code_size+2, &count, 1);; // hex value
-      jit->code_size += 3;
+              "\x80",1);                          // add byte [rsi+offset], count
+      jit->code_size += 1;
+      cellOperand(jit, 0, offset);
+      memcpy((char*)jit->code_buf+jit->code_size, &count, 1); // hex value
+      jit->code_size += 1;
 
     };
     
-    inline void sub(jit_code_t*jit,uint8_t count)override{
-      check_size(jit, 3);
+    inline void sub(jit_code_t*jit,uint8_t count,int32_t offset)override{
+      check_size(jit, 7);
+      int8_t slot = cacheSlot(offset);
+      if(slot >= 0){
+        uint8_t code[4] = {0x41, 0x80, static_cast<uint8_t>(0xE8 | slot), count}; // sub r8b+slot, count
+        memcpy((char*)jit->code_buf + jit->code_size, code, 4);
+        jit->code_size += 4;
+        return;
+      }
       memcpy((char*)jit->code_buf + jit->code_size,
-              "\x80\x2E",2);                        // sub al, count; sub the count to al    
-      memcpy((char*)jit->code_buf+jit->code_size+2, &count, 1); //hex value    
-      jit->code_size += 3;
+              "\x80",1);                          // sub byte [rsi+offset], count
+      jit->code_size += 1;
+      cellOperand(jit, 5, offset);
+      memcpy((char*)jit->code_buf+jit->code_size, &count, 1); //hex value    
+      jit->code_size += 1;
     };
     
-    inline void output(jit_code_t *jit)override{
-      check_size(jit, 12);
+    inline void output(jit_code_t *jit,int32_t offset)override{
+      check_size(jit, 21+2*CACHE_SPILL_SIZE);
+      cacheSpill(jit, true);                      // the flush syscall clobbers r11
       memcpy((char*)jit->code_buf+jit->code_size, 
-              "\xB8\x01\x00\x00\x00"             // mov eax, 1; (sys_write)  
-              "\xBA\x01\x00\x00\x00"             // mov edx, 1; stdout file descriptor
-              "\x0F\x05",12);                    // syscall; syscall
-      jit->code_size += 12;
+              "\x8A",1);                          // mov al, [rsi+offset]
+      jit->code_size += 1;
+      cellOperand(jit, 0, offset);
+      memcpy((char*)jit->code_buf+jit->code_size, 
+              "\x88\x03"                         // mov [rbx], al; append to the output buffer
+              "\x48\xFF\xC3"                     // inc rbx
+              "\x4C\x39\xEB"                     // cmp rbx, r13; buffer full?
+              "\x75\x05",10);                    // jne skip flush
+      jit->code_size += 10;
+      call(jit, flush_address);                   // call flush_out
+      cacheSpill(jit, false);
     };
     
-    inline void input(jit_code_t *jit)override{
-      check_size(jit, 12);
+    inline void input(jit_code_t *jit,int32_t offset)override{
+      check_size(jit, 26+2*CACHE_SPILL_SIZE);
+      cacheSpill(jit, true);
       memcpy((char*)jit->code_buf+jit->code_size,
-             "\xB8\x00\x00\x00\x00"               // mov eax, 0; (sys_read)  
-             "\xBA\x01\x00\x00\x00"               // mov edx, 1; number of bytes to write
-             "\x0F\x05",12);                      // syscall; syscall   
-      jit->code_size += 12;
-
+             "\x4D\x39\xFE"                      // cmp r14, r15; input left in the buffer?
+             "\x72\x09",5);                       // jb load
+      jit->code_size += 5;
+      call(jit, fill_address);                    // call fill_in
+      uint8_t skip = 6 + 1 + cellOperandSize(offset);
+      memcpy((char*)jit->code_buf+jit->code_size,
+             "\x85\xC0"                           // test eax, eax
+             "\x74",3);                            // je skip; on EOF the cell is left unchanged
+      memcpy((char*)jit->code_buf+jit->code_size+3, &skip, 1);
+      memcpy((char*)jit->code_buf+jit->code_size+4,
+             "\x41\x8A\x06"                       // load: mov al, [r14]
+             "\x49\xFF\xC6"                       // inc r14
+             "\x88",7);                            // mov [rsi+offset], al
+      jit->code_size += 11;
+      cellOperand(jit, 0, offset);
+      cacheSpill(jit, false);                     // reload, the cell may have been read into the tape
     };
     
     inline void inc(jit_code_t *jit,uint32_t count)override{
@@ -82,49 +249,433 @@ class X86JIT:public JITInterface {
       check_size(jit, 7);
       memcpy((char*)jit->code_buf+jit->code_size,
               "\x48\x81\xEE",3);                  // sub rsi, count; decrement tape pointer
-      memcpy((char*)jit->code_buf+jit->code_size+3, &count, 5);
+      memcpy((char*)jit->code_buf+jit->code_size+3, &count, 4);
       jit->code_size += 7;
     };
     
-    inline void bneq(jit_code_t *jit, uint32_t jump)override{
+    inline void bneq(jit_code_t *jit, uint32_t jump, bool short_jump)override{
       check_size(jit, 10);
+      zeroTest(jit, 0);
+      if(short_jump){
+        memcpy((char*)jit->code_buf+jit->code_size, 
+               "\x75\x00",2);                      // jne rel8; jump if not equal
+        jit->code_size += 2;
+        int8_t offset = static_cast<int8_t>(static_cast<int64_t>(jump) - static_cast<int64_t>(jit->code_size));
+        memcpy((char*)jit->code_buf+jit->code_size-SHORT_BRANCH_ADDRESS_SIZE, &offset, SHORT_BRANCH_ADDRESS_SIZE);
+        return;
+      }
       memcpy((char*)jit->code_buf+jit->code_size, 
-                    "\x8A\x06"                   // mov al, [rsi]; load current cell value into rax    
-                    "\x3C\x00"                   // cmp al, 0; compare rax with 0 
-                    "\x0F\x85",6);               // jne lable_jump; jump if not equal
-      jit->code_size += 10;
+             "\x0F\x85\x00\x00\x00\x00",6);         // jne rel32; jump if not equal
+      jit->code_size += 6;
       // Calculate the offset for the jump
       int32_t offset = static_cast<int32_t>(jump - jit->code_size);
       // Write the offset to the code buffer
       memcpy((char*)jit->code_buf+jit->code_size-BRANCH_ADDRESS_SIZE, &offset, BRANCH_ADDRESS_SIZE); 
     };
     
-    inline void beqz(jit_code_t*jit)override{
-      check_size(jit, 10);
+    inline void beqz(jit_code_t*jit,int32_t offset,bool short_jump)override{
+      check_size(jit, 13);
+      zeroTest(jit, offset);
+      if(short_jump){
+        memcpy((char*)jit->code_buf+jit->code_size, 
+               "\x74\x00",2);                      // je rel8; jump if equal
+        jit->code_size += 2;
+        return;
+      }
       memcpy((char*)jit->code_buf+jit->code_size, 
-             "\x8A\x06"                           // mov al, [rsi]; load current cell value into rax    
-             "\x3C\x00"                           // cmp al, 0; compare rax with 0 
-             "\x0F\x84\x00\x00\x00\x00",10);      // je lable_jump; jump if equal
+             "\x0F\x84\x00\x00\x00\x00",6);         // je rel32; jump if equal
+      jit->code_size += 6;
+    };
+
+    inline void mov0(jit_code_t *jit,int32_t offset)override{
+      check_size(jit, 7);
+      int8_t slot = cacheSlot(offset);
+      if(slot >= 0){
+        uint8_t code[3] = {0x41, static_cast<uint8_t>(0xB0 | slot), 0x00}; // mov r8b+slot, 0
+        memcpy((char*)jit->code_buf+jit->code_size, code, 3);
+        jit->code_size += 3;
+        return;
+      }
+      memcpy((char*)jit->code_buf+jit->code_size, 
+             "\xC6",1);                            // mov byte [rsi+offset], 0
+      jit->code_size += 1;
+      cellOperand(jit, 0, offset);
+      memcpy((char*)jit->code_buf+jit->code_size, 
+             "\x00",1);
+      jit->code_size += 1;
+    };
+
+    inline void mul(jit_code_t *jit, int32_t source, int32_t target, uint8_t factor)override{
+      check_size(jit, 16);
+      int8_t source_slot = cacheSlot(source);
+      int8_t target_slot = cacheSlot(target);
+      if(factor==1 || factor==255){
+        if(source_slot >= 0){
+          uint8_t code[3] = {0x41, 0x8A, static_cast<uint8_t>(0xC0 | source_slot)}; // mov al, r8b+source_slot
+          memcpy((char*)jit->code_buf+jit->code_size, code, 3);
+          jit->code_size += 3;
+        }
+        else{
+          memcpy((char*)jit->code_buf+jit->code_size, 
+                 "\x8A",1);                        // mov al, [rsi+source]
+          jit->code_size += 1;
+          cellOperand(jit, 0, source);
+        }
+      }
+      else{
+        if(source_slot >= 0){
+          uint8_t code[4] = {0x41, 0x0F, 0xB6, static_cast<uint8_t>(0xC0 | source_slot)}; // movzx eax, r8b+source_slot
+          memcpy((char*)jit->code_buf+jit->code_size, code, 4);
+          jit->code_size += 4;
+        }
+        else{
+          memcpy((char*)jit->code_buf+jit->code_size, 
+                 "\x0F\xB6",2);                   // movzx eax, byte [rsi+source]
+          jit->code_size += 2;
+          cellOperand(jit, 0, source);
+        }
+        memcpy((char*)jit->code_buf+jit->code_size, 
+               "\x6B\xC0",2);                      // imul eax, eax, factor
+        memcpy((char*)jit->code_buf+jit->code_size+2, &factor, 1); 
+        jit->code_size += 3;
+      }
+      uint8_t opcode = factor==255 ? 0x28 : 0x00;  // sub/add
+      if(target_slot >= 0){
+        uint8_t code[3] = {0x41, opcode, static_cast<uint8_t>(0xC0 | target_slot)}; // add/sub r8b+target_slot, al
+        memcpy((char*)jit->code_buf+jit->code_size, code, 3);
+        jit->code_size += 3;
+      }
+      else{
+        memcpy((char*)jit->code_buf+jit->code_size, &opcode, 1); // add/sub [rsi+target], al
+        jit->code_size += 1;
+        cellOperand(jit, 0, target);
+      }
+    };
+
+    inline void scan(jit_code_t *jit, int32_t stride)override{
+      check_size(jit, 40);
+      uint32_t step = stride < 0 ? -static_cast<uint32_t>(stride) : static_cast<uint32_t>(stride);
+      bool forward = stride > 0;
+      if(step >= vector_width){
+        // too sparse to check more than one cell per vector
+        size_t loop = jit->code_size;
+        memcpy((char*)jit->code_buf+jit->code_size, 
+               "\x80\x3E\x00"                      // cmp byte [rsi], 0
+               "\x74\x09",5);                      // je done
+        memcpy((char*)jit->code_buf+jit->code_size+5, 
+               forward ? "\x48\x81\xC6" : "\x48\x81\xEE",3);  // add/sub rsi, step
+        memcpy((char*)jit->code_buf+jit->code_size+8, &step, 4);
+        jit->code_size += 12;
+        jump8(jit, loop);                         // jmp loop
+        return;
+      }
+
+      // every vector checks the cells at 0, step, 2*step... from the first (last when going left) byte
+      uint32_t cells = (vector_width - 1) / step + 1;
+      uint8_t advance = static_cast<uint8_t>(cells * step);
+      uint32_t mask = 0;
+      for(uint32_t k = 0; k < cells; k++)
+        mask |= 1u << (forward ? k * step : vector_width - 1 - k * step);
+      int8_t back = static_cast<int8_t>(1 - static_cast<int32_t>(vector_width)); // offset of the vector when going left
+
+      if(vector_width == 32){
+        memcpy((char*)jit->code_buf+jit->code_size, 
+               "\xC5\xF1\xEF\xC9",4);              // vpxor xmm1, xmm1, xmm1
+        jit->code_size += 4;
+      }
+      else{
+        memcpy((char*)jit->code_buf+jit->code_size, 
+               "\x66\x0F\xEF\xC9",4);              // pxor xmm1, xmm1
+        jit->code_size += 4;
+      }
+      size_t loop = jit->code_size;
+      if(vector_width == 32){
+        memcpy((char*)jit->code_buf+jit->code_size, 
+               "\xC5\xF5\x74",3);                  // vpcmpeqb ymm0, ymm1, [rsi]
+        jit->code_size += 3;
+        cellOperand(jit, 0, forward ? 0 : back);
+        memcpy((char*)jit->code_buf+jit->code_size, 
+               "\xC5\xFD\xD7\xC0",4);              // vpmovmskb eax, ymm0
+        jit->code_size += 4;
+      }
+      else{
+        memcpy((char*)jit->code_buf+jit->code_size, 
+               "\xF3\x0F\x6F",3);                  // movdqu xmm0, [rsi]
+        jit->code_size += 3;
+        cellOperand(jit, 0, forward ? 0 : back);
+        memcpy((char*)jit->code_buf+jit->code_size, 
+               "\x66\x0F\x74\xC1"                  // pcmpeqb xmm0, xmm1
+               "\x66\x0F\xD7\xC0",8);              // pmovmskb eax, xmm0
+        jit->code_size += 8;
+      }
+      if(step > 1){
+        memcpy((char*)jit->code_buf+jit->code_size, 
+               "\x25",1);                          // and eax, mask; keep only the cells of the stride
+        memcpy((char*)jit->code_buf+jit->code_size+1, &mask, 4);
+        jit->code_size += 5;
+      }
+      else{
+        memcpy((char*)jit->code_buf+jit->code_size, 
+               "\x85\xC0",2);                      // test eax, eax
+        jit->code_size += 2;
+      }
+      memcpy((char*)jit->code_buf+jit->code_size, 
+             "\x75\x06",2);                        // jnz found
+      memcpy((char*)jit->code_buf+jit->code_size+2, 
+             forward ? "\x48\x83\xC6" : "\x48\x83\xEE",3);   // add/sub rsi, advance
+      memcpy((char*)jit->code_buf+jit->code_size+5, &advance, 1);
+      jit->code_size += 6;
+      jump8(jit, loop);                           // jmp loop
+      if(vector_width == 32){
+        memcpy((char*)jit->code_buf+jit->code_size, 
+               "\xC5\xF8\x77",3);                  // found: vzeroupper
+        jit->code_size += 3;
+      }
+      if(forward){
+        memcpy((char*)jit->code_buf+jit->code_size, 
+               "\x0F\xBC\xC0"                      // bsf eax, eax; first zero cell
+               "\x48\x01\xC6",6);                  // add rsi, rax
+        jit->code_size += 6;
+      }
+      else{
+        memcpy((char*)jit->code_buf+jit->code_size, 
+               "\x0F\xBD\xC0"                      // bsr eax, eax; last zero cell
+               "\x48\x8D\x74\x06",7);              // lea rsi, [rsi+rax-(vector_width-1)]
+        memcpy((char*)jit->code_buf+jit->code_size+7, &back, 1);
+        jit->code_size += 8;
+      }
+    };
+
+    inline void cacheLoad(jit_code_t *jit, const int32_t *offsets, uint8_t count)override{
+      check_size(jit, CACHE_SPILL_SIZE);
+      cache_count = count < CACHE_REGISTERS ? count : CACHE_REGISTERS;
+      for(uint8_t k = 0; k < cache_count; k++)
+        cache_offsets[k] = offsets[k];
+      cacheSpill(jit, false);
+    };
+
+    inline void cacheStore(jit_code_t *jit)override{
+      check_size(jit, CACHE_SPILL_SIZE);
+      cacheSpill(jit, true);
+      cache_count = 0;
+    };
+
+    inline void elfEntry(jit_code_t *jit, uint32_t tape, uint32_t io, uint32_t output, uint32_t output_size)override{
+      check_size(jit, 35+24);
+      if(output_size){
+        memcpy((char*)jit->code_buf+jit->code_size, 
+               "\xBE",1);                          // mov esi, output
+        memcpy((char*)jit->code_buf+jit->code_size+1, &output, 4);
+        memcpy((char*)jit->code_buf+jit->code_size+5, 
+               "\xBA",1);                          // mov edx, output_size
+        memcpy((char*)jit->code_buf+jit->code_size+6, &output_size, 4);
+        memcpy((char*)jit->code_buf+jit->code_size+10, 
+               // write: until every byte is out
+               "\xB8\x01\x00\x00\x00"                // mov eax, 1; (sys_write)
+               "\xBF\x01\x00\x00\x00"                // mov edi, 1; stdout file descriptor
+               "\x0F\x05"                            // syscall
+               "\x48\x85\xC0"                        // test rax, rax
+               "\x7E\x08"                            // jle done; give up on error
+               "\x48\x01\xC6"                        // add rsi, rax; handle partial writes to pipes
+               "\x48\x29\xC2"                        // sub rdx, rax
+               "\x75\xE7",25);                       // jnz write
+        jit->code_size += 35;                     // done:
+      }
+      memcpy((char*)jit->code_buf+jit->code_size, 
+             "\xBF",1);                            // mov edi, tape
+      memcpy((char*)jit->code_buf+jit->code_size+1, &tape, 4);
+      memcpy((char*)jit->code_buf+jit->code_size+5, 
+             "\xBE",1);                            // mov esi, io
+      memcpy((char*)jit->code_buf+jit->code_size+6, &io, 4);
       jit->code_size += 10;
+      call(jit, 0);                               // call the program
+      memcpy((char*)jit->code_buf+jit->code_size, 
+             "\xB8\x3C\x00\x00\x00"                // mov eax, 60; (sys_exit)
+             "\x31\xFF"                            // xor edi, edi; status 0
+             "\x0F\x05",9);                        // syscall
+      jit->code_size += 9;
+    };
+
+    inline void breakpoint(jit_code_t *jit, uint32_t pc)override{
+      check_size(jit, 12+5+46);
+      uint32_t field = offsetof(jit_io_t, break_pc);
+      memcpy((char*)jit->code_buf+jit->code_size, 
+             "\x41\xC7\x84\x24",4);                // mov dword [r12+break_pc], pc
+      memcpy((char*)jit->code_buf+jit->code_size+4, &field, 4);
+      memcpy((char*)jit->code_buf+jit->code_size+8, &pc, 4);
+      jit->code_size += 12;
+      call(jit, flush_address);                   // call flush_out; the debugger prints after the program
+      fragmentEnd(jit);                           // no call is pending, the stack is the one of the entry
     };
 
-    inline void mov0(jit_code_t *jit)override{
-      check_size(jit, 3);
+    inline void counter(jit_code_t *jit, uint64_t *address)override{
+      check_size(jit, 13);
       memcpy((char*)jit->code_buf+jit->code_size, 
-             "\xC6\x06\x00",3);                   // mov [rsi], 0
-      jit->code_size += 3;
+             "\x48\xB8",2);                        // mov rax, address
+      memcpy((char*)jit->code_buf+jit->code_size+2, &address, 8);
+      memcpy((char*)jit->code_buf+jit->code_size+10, 
+             "\x48\xFF\x00",3);                    // inc qword [rax]
+      jit->code_size += 13;
     };
 
-    inline void addto(jit_code_t *jit, uint8_t count)override{
-      check_size(jit, 8);
+    inline void align(jit_code_t *jit, uint8_t boundary)override{
+      // the recommended multi-byte nops, nop [rax+rax*1+0] and its shorter forms
+      static const char *nops[10] = {"",
+        "\x90",
+        "\x66\x90",
+        "\x0F\x1F\x00",
+        "\x0F\x1F\x40\x00",
+        "\x0F\x1F\x44\x00\x00",
+        "\x66\x0F\x1F\x44\x00\x00",
+        "\x0F\x1F\x80\x00\x00\x00\x00",
+        "\x0F\x1F\x84\x00\x00\x00\x00\x00",
+        "\x66\x0F\x1F\x84\x00\x00\x00\x00\x00"};
+      size_t padding = (boundary - jit->code_size % boundary) % boundary;
+      check_size(jit, padding);
+      while(padding > 0){
+        size_t size = padding > 9 ? 9 : padding;
+        memcpy((char*)jit->code_buf+jit->code_size, nops[size], size);
+        jit->code_size += size;
+        padding -= size;
+      }
+    };
+
+    inline void lazyRuntime(jit_code_t *jit, const void *state, const void *resolver)override{
+      check_size(jit, 35);
+      lazy_address = jit->code_size;
       memcpy((char*)jit->code_buf+jit->code_size, 
-             "\x8A\x06\x00"
-             "\x46",4);                           // add al, count; add the count to [rsi]
-      
-      memcpy((char*)jit->code_buf+jit->code_size+4, &count, 1); // hex value
-      memcpy((char*)jit->code_buf+jit->code_size+5,
-             "\xC6\x06\x00",3);                       // mov [rsi],0;
-      jit->code_size += 8;
+             "\x56"                                // push rsi; the only live register the resolver may clobber
+             "\x48\x8B\x74\x24\x08"                // mov rsi, [rsp+8]; return address of the stub
+             "\x48\xBF\x00\x00\x00\x00\x00\x00\x00\x00" // mov rdi, state
+             "\x48\xB8\x00\x00\x00\x00\x00\x00\x00\x00" // mov rax, resolver
+             "\xFF\xD0"                            // call rax; the stack is 16 byte aligned here
+             "\x5E"                                // pop rsi
+             "\x48\x83\xC4\x08"                    // add rsp, 8; the loop jumps back after the stub by itself
+             "\xFF\xE0",35);                       // jmp rax
+      memcpy((char*)jit->code_buf+jit->code_size+8, &state, 8);
+      memcpy((char*)jit->code_buf+jit->code_size+18, &resolver, 8);
+      jit->code_size += 35;
+    };
+
+    inline void lazyStub(jit_code_t *jit)override{
+      call(jit, lazy_address);                    // call lazy_compile, patched to a jmp rel32 to the loop
+    };
+
+    inline void jump(jit_code_t *jit, uint32_t target)override{
+      check_size(jit, 5);
+      int32_t offset = static_cast<int32_t>(target - (jit->code_size + 5));
+      memcpy((char*)jit->code_buf+jit->code_size, "\xE9", 1);   // jmp rel32
+      memcpy((char*)jit->code_buf+jit->code_size+1, &offset, 4);
+      jit->code_size += 5;
+    };
+
+  private:
+    uint32_t vector_width = 16;                   // bytes compared at once by scan, 32 when AVX2 is available
+    int32_t cache_offsets[CACHE_REGISTERS];       // cell held by r8b+k while a loop is cached
+    uint8_t cache_count = 0;                      // registers in use, 0 outside cached loops
+    uint32_t flush_address = 0;                   // offset of the out-of-line flush_out routine
+    uint32_t fill_address = 0;                    // offset of the out-of-line fill_in routine
+    uint32_t lazy_address = 0;                    // offset of the routine called by the stubs of the lazy JIT
+
+    /**
+     * @brief returns the register (r8b + slot) holding the cell at offset, -1 if the cell lives on the tape.
+     */
+    inline int8_t cacheSlot(int32_t offset){
+      for(uint8_t k = 0; k < cache_count; k++)
+        if(cache_offsets[k] == offset)
+          return static_cast<int8_t>(k);
+      return -1;
+    };
+
+    /**
+     * @brief moves every cached cell between its register and the tape, nothing is emitted outside cached loops.
+     * @param store true writes the registers to the tape, false loads them from it.
+     */
+    inline void cacheSpill(jit_code_t *jit, bool store){
+      for(uint8_t k = 0; k < cache_count; k++){
+        memcpy((char*)jit->code_buf+jit->code_size, 
+               store ? "\x44\x88" : "\x44\x8A",2);   // mov [rsi+offset], r8b+k / mov r8b+k, [rsi+offset]
+        jit->code_size += 2;
+        cellOperand(jit, k, cache_offsets[k]);
+      }
+    };
+
+    /**
+     * @brief sets the flags on the cell at offset for the je/jne of a branch, using its register if the cell is cached.
+     */
+    inline void zeroTest(jit_code_t *jit, int32_t offset){
+      int8_t slot = cacheSlot(offset);
+      if(slot >= 0){
+        uint8_t test[3] = {0x45, 0x84, static_cast<uint8_t>(0xC0 | slot << 3 | slot)}; // test r8b+slot, r8b+slot
+        memcpy((char*)jit->code_buf+jit->code_size, test, 3);
+        jit->code_size += 3;
+        return;
+      }
+      memcpy((char*)jit->code_buf+jit->code_size, 
+             "\x80",1);                            // cmp byte [rsi+offset], 0
+      jit->code_size += 1;
+      cellOperand(jit, 7, offset);
+      memcpy((char*)jit->code_buf+jit->code_size, 
+             "\x00",1);
+      jit->code_size += 1;
+    };
+
+    /**
+     * @brief emits the ModRM byte and displacement of a [rsi+offset] memory operand.
+     * The shortest displacement that fits the offset is used.
+     * @param reg The value of the reg field of the ModRM byte, either a register or an opcode extension.
+     */
+    inline void cellOperand(jit_code_t *jit, uint8_t reg, int32_t offset){
+      check_size(jit, 5);
+      uint8_t modrm = (reg & 7) << 3 | 0x06;
+      if(offset == 0){
+        memcpy((char*)jit->code_buf+jit->code_size, &modrm, 1);          // [rsi]
+        jit->code_size += 1;
+      }
+      else if(offset >= -128 && offset <= 127){
+        modrm |= 0x40;
+        int8_t disp = static_cast<int8_t>(offset);
+        memcpy((char*)jit->code_buf+jit->code_size, &modrm, 1);          // [rsi+disp8]
+        memcpy((char*)jit->code_buf+jit->code_size+1, &disp, 1);
+        jit->code_size += 2;
+      }
+      else{
+        modrm |= 0x80;
+        memcpy((char*)jit->code_buf+jit->code_size, &modrm, 1);          // [rsi+disp32]
+        memcpy((char*)jit->code_buf+jit->code_size+1, &offset, 4);
+        jit->code_size += 5;
+      }
+    };
+
+    /**
+     * @brief returns the number of bytes cellOperand emits for offset.
+     */
+    inline uint8_t cellOperandSize(int32_t offset){
+      if(offset == 0)
+        return 1;
+      return offset >= -128 && offset <= 127 ? 2 : 5;
+    };
+
+    /**
+     * @brief emits a short jump back to target, which must be less than 128 bytes away.
+     */
+    inline void jump8(jit_code_t *jit, size_t target){
+      check_size(jit, 2);
+      int8_t offset = static_cast<int8_t>(static_cast<int64_t>(target) - static_cast<int64_t>(jit->code_size + 2));
+      memcpy((char*)jit->code_buf+jit->code_size, "\xEB", 1);   // jmp rel8
+      memcpy((char*)jit->code_buf+jit->code_size+1, &offset, 1);
+      jit->code_size += 2;
+    };
+
+    /**
+     * @brief emits a near call to one of the out-of-line runtime routines emitted by proStart.
+     */
+    inline void call(jit_code_t *jit, uint32_t target){
+      check_size(jit, 5);
+      int32_t offset = static_cast<int32_t>(target - (jit->code_size + 5));
+      memcpy((char*)jit->code_buf+jit->code_size, "\xE8", 1);   // call rel32
+      memcpy((char*)jit->code_buf+jit->code_size+1, &offset, 4);
+      jit->code_size += 5;
     };
 };
 
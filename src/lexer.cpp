@@ -1,124 +1,382 @@
 #include "lexer.hpp"
-std::vector<Instruction> lexer(CompilerOptions options,std::map<InstructionType,uint16_t> &instructions_map) { 
-    FILE* file = fopen(options.source_file_name.c_str(), "rb");
-    if (!file) {
-      std::cerr << "Error: Could not open source file '" << options.source_file_name << "'." << std::endl;
-      exit(EXIT_FAILURE);
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <algorithm>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define LEXER_VECTOR 32
+typedef __m256i lexer_vector_t;
+#define vload(p) _mm256_loadu_si256((const __m256i*)(p))
+#define vset(c) _mm256_set1_epi8(c)
+#define veq(a, b) _mm256_cmpeq_epi8(a, b)
+#define vor(a, b) _mm256_or_si256(a, b)
+#define vsub(a, b) _mm256_sub_epi8(a, b)
+#define vmin(a, b) _mm256_min_epu8(a, b)
+#define vmask(a) static_cast<uint32_t>(_mm256_movemask_epi8(a))
+#elif defined(__SSE2__)
+#define LEXER_VECTOR 16
+typedef __m128i lexer_vector_t;
+#define vload(p) _mm_loadu_si128((const __m128i*)(p))
+#define vset(c) _mm_set1_epi8(c)
+#define veq(a, b) _mm_cmpeq_epi8(a, b)
+#define vor(a, b) _mm_or_si128(a, b)
+#define vsub(a, b) _mm_sub_epi8(a, b)
+#define vmin(a, b) _mm_min_epu8(a, b)
+#define vmask(a) static_cast<uint32_t>(_mm_movemask_epi8(a))
+#endif
+
+/**
+ * @brief returns true if c is a command, '#' included when debugging.
+ */
+static inline bool isCommand(char c, bool debug) {
+  switch(c){
+    case '+': case '-': case '<': case '>': case '.': case ',': case '[': case ']':
+      return true;
+    case '#':
+      return debug;
+    default:
+      return false;
+  }
+}
+
+#ifdef LEXER_VECTOR
+/**
+ * @brief returns a bit per byte of the block at p, set for the commands.
+ * + , - . are the range 0x2B-0x2E, < and > are 0x3C and 0x3E and differ in the bit 0x02 only.
+ */
+static inline uint32_t commandMask(const char *p, bool debug) {
+  lexer_vector_t block = vload(p);
+  lexer_vector_t arithmetic = vsub(block, vset(0x2B));
+  lexer_vector_t commands = veq(vmin(arithmetic, vset(3)), arithmetic);
+  commands = vor(commands, veq(vor(block, vset(0x02)), vset('>')));
+  commands = vor(commands, vor(veq(block, vset('[')), veq(block, vset(']'))));
+  if(debug)
+    commands = vor(commands, veq(block, vset('#')));
+  return vmask(commands);
+}
+#endif
+
+/**
+ * @brief returns the index of the first command at or after i, size if there is none.
+ * Comments are skipped a vector at a time.
+ */
+static inline size_t nextCommand(const char *buffer, size_t i, size_t size, bool debug) {
+  if(i<size && isCommand(buffer[i], debug))
+    return i; // dense code, commands follow each other
+#ifdef LEXER_VECTOR
+  for(;i+LEXER_VECTOR<=size;i+=LEXER_VECTOR){
+    uint32_t mask = commandMask(buffer+i, debug);
+    if(mask)
+      return i + __builtin_ctz(mask);
+  }
+#endif
+  while(i<size && !isCommand(buffer[i], debug))
+    i++;
+  return i;
+}
+
+/**
+ * @brief returns true if runs of c are merged into one instruction.
+ */
+static inline bool isRun(char c) {
+  return c == '+' || c == '-' || c == '>' || c == '<';
+}
+
+/**
+ * @brief returns how many times the byte at i repeats from i on, at least 1.
+ */
+static inline size_t runLength(const char *buffer, size_t i, size_t size) {
+  char c = buffer[i];
+  size_t k = i + 1;
+#ifdef LEXER_VECTOR
+  lexer_vector_t repeated = vset(c);
+  for(;k+LEXER_VECTOR<=size;k+=LEXER_VECTOR){
+    uint32_t different = ~vmask(veq(vload(buffer+k), repeated));
+#if LEXER_VECTOR == 16
+    different &= 0xFFFF;
+#endif
+    if(different)
+      return k + __builtin_ctz(different) - i;
+  }
+#endif
+  while(k<size && buffer[k]==c)
+    k++;
+  return k - i;
+}
+
+/**
+ * @brief returns the number of commands in buffer, the most instructions it can lex to.
+ */
+static size_t countCommands(const char *buffer, size_t size, bool debug) {
+  size_t count = 0;
+  size_t i = 0;
+#ifdef LEXER_VECTOR
+  for(;i+LEXER_VECTOR<=size;i+=LEXER_VECTOR)
+    count += __builtin_popcount(commandMask(buffer+i, debug));
+#endif
+  for(;i<size;i++)
+    count += isCommand(buffer[i], debug);
+  return count;
+}
+
+/**
+ * @brief the instructions of a slice of the source, lexed on its own.
+ * Brackets are matched inside the slice, the ones matched across slices are left in opens and closes.
+ */
+typedef struct{
+  size_t begin;                     // first byte of the slice
+  size_t end;
+  std::vector<Instruction> instructions;
+  std::vector<uint32_t> opens;      // '[' left open at the end of the slice, outermost first
+  std::vector<uint32_t> closes;     // ']' closing a '[' of an earlier slice, in order
+  uint32_t counts[256];             // instructions by type
+}lexer_chunk_t;
+
+/**
+ * @brief lexes the bytes [chunk.begin, chunk.end) of buffer, runs stop at the end of the slice.
+ * Matched brackets point to each other by their index in the slice.
+ */
+static void lexChunk(const char *buffer, lexer_chunk_t &chunk, CompilerOptions &options) {
+  std::vector<Instruction> &instructions = chunk.instructions;
+  // every command is at most one instruction, runs only make it less: the vector never grows
+  instructions.reserve(countCommands(buffer + chunk.begin, chunk.end - chunk.begin, options.debug));
+  memset(chunk.counts, 0, sizeof(chunk.counts));
+  std::vector<uint32_t> &cycle_stack = chunk.opens;
+  size_t end = chunk.end;
+  size_t i = nextCommand(buffer, chunk.begin, end, options.debug);
+  while(i<end) {
+    uint32_t pc = instructions.size();
+    Instruction instruction;
+    instruction.extra = 1;
+    instruction.arg = 0;
+    instruction.offset = 0;
+    size_t length = 1;
+
+    switch (buffer[i])
+    {
+    case '+':
+      instruction.type = InstructionType::ADD;
+      break;
+    case '-':
+      instruction.type = InstructionType::SUB;
+      break;
+    case '.':
+      instruction.type = InstructionType::OUTPUT;
+      break;
+    case ',':
+      instruction.type = InstructionType::INPUT;
+      break;
+    case '>':
+      instruction.type = InstructionType::INC;
+      break;
+    case '<':
+      instruction.type = InstructionType::DEC;
+      break;
+    case '[':
+      instruction.type = InstructionType::BEQZ;
+      cycle_stack.push_back(pc);
+      break;
+    case '#':
+      instruction.type = InstructionType::BREAK; // only a command when debugging, a comment otherwise
+      break;
+    default: // ']'
+      instruction.type = InstructionType::BNEQ;
+      if(cycle_stack.empty()) {
+        chunk.closes.push_back(pc); // matched when the slices are joined, or unmatched
+        break;
+      }
+      instruction.extra = cycle_stack.back();
+      cycle_stack.pop_back();
+      instructions[instruction.extra].extra = pc;
+      break;
     }
-    
-    fseek(file, 0, SEEK_END);
-    size_t size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    
-    char* buffer = (char*)malloc(size);
-    if (!buffer) {
-      fclose(file);
-      std::cerr << "Error: Lexer memory allocation failed." << std::endl;
-      exit(EXIT_FAILURE);
+    if(options.optimize && isRun(buffer[i])) {
+      length = runLength(buffer, i, end); // merge the run of the same command
+      instruction.extra = length;
     }
-    
-    // Read entire file
-    size_t read = fread(buffer, 1, size, file);
-    fclose(file);
-    
-    if (read != size) {
-      free(buffer);
-      std::cerr << "Error: Could not read the entire source file." << std::endl;
+    instructions.push_back(instruction);
+    chunk.counts[static_cast<uint8_t>(instruction.type)]++;
+    i = nextCommand(buffer, i + length, end, options.debug);
+  }
+}
+
+/**
+ * @brief runs body(k) for k in [0, n), each on its own thread, the first one on the calling thread.
+ */
+template<typename F>
+static void parallelFor(size_t n, F body) {
+  std::vector<std::thread> threads;
+  for(size_t k=1;k<n;k++)
+    threads.emplace_back(body, k);
+  body(0);
+  for(std::thread &thread : threads)
+    thread.join();
+}
+
+/**
+ * @brief maps the source file read only and sets size, exits if it cannot be read.
+ * @return the mapping, NULL for an empty file.
+ */
+static const char* mapSource(CompilerOptions &options, size_t &size) {
+  int fd = open(options.source_file_name.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    std::cerr << "Error: Could not open source file '" << options.source_file_name << "'." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  size = st.st_size;
+  const char *buffer = NULL;
+  if (size > 0) {
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      close(fd);
+      std::cerr << "Error: Could not map the source file: " << strerror(errno) << std::endl;
       exit(EXIT_FAILURE);
     }
-  
+    madvise(map, size, MADV_SEQUENTIAL);
+    buffer = (const char*)map;
+  }
+  close(fd);
+  return buffer;
+}
+
+std::vector<Instruction> lexer(CompilerOptions options,std::map<InstructionType,uint32_t> &instructions_map) {
+    size_t size = 0;
+    const char *buffer = mapSource(options, size);
+
+    // one slice per thread, small sources are lexed by the calling thread alone
+    size_t threads = options.lexer_threads ? options.lexer_threads : std::max(1u, std::thread::hardware_concurrency());
+    size_t slices = std::max<size_t>(1, std::min(threads, size / LEXER_CHUNK_MIN));
+    std::vector<lexer_chunk_t> chunks(slices);
+    for(size_t k=0;k<slices;k++){
+      chunks[k].begin = size * k / slices;
+      chunks[k].end = size * (k + 1) / slices;
+    }
+    parallelFor(slices, [&](size_t k){ lexChunk(buffer, chunks[k], options); });
+
+    // where each slice goes in the program. A run crossing into a slice is added to the last instruction
+    // before it, the instruction that started it, and its first instruction dropped
+    std::vector<size_t> base(slices + 1, 0);   // index of the first instruction of every slice
+    std::vector<size_t> skip(slices, 0);       // instructions of the slice dropped, 1 if its first one continues a run
+    uint32_t counts[256] = {0};
+    for(size_t k=0;k<slices;k++){
+      lexer_chunk_t &chunk = chunks[k];
+      if(options.optimize && k > 0 && chunk.begin < chunk.end && isRun(buffer[chunk.begin]) && buffer[chunk.begin-1] == buffer[chunk.begin])
+        skip[k] = 1;
+      base[k+1] = base[k] + chunk.instructions.size() - skip[k];
+      for(int type=0;type<256;type++)
+        counts[type] += chunk.counts[type];
+      if(skip[k])
+        counts[static_cast<uint8_t>(chunk.instructions[0].type)]--;
+    }
     std::vector<Instruction> instructions;
-    uint64_t pc = 0;
-  
-    if(options.debug)
-      options.optimize = false; 
-    
-    std::stack<uint64_t> cycle_stack;
-    int i=0;
-    while(i<size) {
-      Instruction instruction;
-      instruction.extra = 1; 
-      instruction.type = InstructionType::UNKNOWN; 
-  
-      switch (buffer[i])
-      {
-      case '+':
-        while(buffer[i+1] == '+' && options.optimize) {
-          instruction.extra++;
-          i++;
-        }
-        instruction.type = InstructionType::ADD;
-        instructions.push_back(instruction);
-        
-        break;
-      case '-':
-  
-        while(buffer[i+1] == '-'&&options.optimize) {
-          instruction.extra++;
-          i++;
-        }
-        instruction.type = InstructionType::SUB;
-        instructions.push_back(instruction);
-        break;
-      case '.':
-  
-        instruction.type = InstructionType::OUTPUT;
-        instructions.push_back(instruction);
-        break;
-      case ',':
-  
-        instruction.type = InstructionType::INPUT;
-        instructions.push_back(instruction);
-        break;
-      case '>':
-  
-        while(buffer[i+1] == '>'&&options.optimize) {
-          instruction.extra++;
-          i++;
-        }
-        instruction.type = InstructionType::INC;
-        instructions.push_back(instruction);
-        break;
-      case '<':
-        while(buffer[i+1] == '<'&&options.optimize) {
-          instruction.extra++;
-          i++;
+    if(slices == 1)
+      instructions.swap(chunks[0].instructions); // nothing to move, the brackets are already in place
+    else{
+      instructions.resize(base[slices]);
+      parallelFor(slices, [&](size_t k){
+        // the brackets matched in the slice move with it, the ones matched across slices are set below
+        lexer_chunk_t &chunk = chunks[k];
+        int64_t shift = static_cast<int64_t>(base[k]) - static_cast<int64_t>(skip[k]);
+        for(size_t n=skip[k];n<chunk.instructions.size();n++){
+          Instruction instruction = chunk.instructions[n];
+          if(instruction.type == InstructionType::BEQZ || instruction.type == InstructionType::BNEQ)
+            instruction.extra += shift;
+          instructions[n + shift] = instruction;
         }
-        instruction.type = InstructionType::DEC;
-        instructions.push_back(instruction);
-        break;
-      case '[':
-  
-        instruction.type = InstructionType::BEQZ;
-        cycle_stack.push(pc); 
-        instructions.push_back(instruction);
-        break;
-      case ']':
-  
+      });
+    }
+
+    std::vector<uint32_t> cycle_stack;
+    for(size_t k=0;k<slices;k++){
+      lexer_chunk_t &chunk = chunks[k];
+      if(skip[k])
+        instructions[base[k]-1].extra += chunk.instructions[0].extra;
+      uint32_t shift = base[k] - skip[k];
+      for(uint32_t close : chunk.closes){
+        uint32_t pc = close + shift;
         if(cycle_stack.empty()) {
           std::cerr << "Error: Unmatched ']' at program counter " << pc << std::endl;
           exit(EXIT_FAILURE);
         }
-        instruction.type = InstructionType::BNEQ;
-        instruction.extra = cycle_stack.top();
-        cycle_stack.pop();
-        instructions[instruction.extra].extra = pc; 
-        instructions.push_back(instruction);
-        break;
-      default:
-        break;
+        instructions[pc].extra = cycle_stack.back();
+        instructions[cycle_stack.back()].extra = pc;
+        cycle_stack.pop_back();
       }
-      if(instruction.type != InstructionType::UNKNOWN) {
-        instructions_map[instruction.type] += 1; 
-        pc++;
-      }
-      i++;
+      for(uint32_t open : chunk.opens)
+        cycle_stack.push_back(open + shift);
     }
     if(!cycle_stack.empty()){
-      std::cerr << "Error: Unmatched '[' at program counter " << cycle_stack.top() << std::endl;
+      std::cerr << "Error: Unmatched '[' at program counter " << cycle_stack.back() << std::endl;
       exit(EXIT_FAILURE);
     }
-    free(buffer);
+    for(int type=0;type<256;type++)
+      if(counts[type])
+        instructions_map[static_cast<InstructionType>(type)] += counts[type];
+    if (size > 0)
+      munmap((void*)buffer, size);
     return instructions;
   }
-  
\ No newline at end of file
+
+void lexerOpen(lexer_stream_t &stream, CompilerOptions &options) {
+  stream.buffer = mapSource(options, stream.size);
+  stream.position = 0;
+  stream.released = 0;
+  stream.lexed = 0;
+  stream.open.clear();
+  memset(stream.counts, 0, sizeof(stream.counts));
+  stream.error.clear();
+}
+
+bool lexerNext(lexer_stream_t &stream, instructions_list &instructions, CompilerOptions &options) {
+  if(stream.position >= stream.size){
+    if(!stream.open.empty())
+      stream.error = "Error: Unmatched '[' at program counter " + std::to_string(stream.open.back());
+    return false;
+  }
+  // a run is never cut, it would be two instructions otherwise
+  lexer_chunk_t chunk;
+  chunk.begin = stream.position;
+  chunk.end = std::min(stream.size, stream.position + LEXER_WINDOW);
+  if(options.optimize && chunk.end < stream.size && isRun(stream.buffer[chunk.end-1]))
+    chunk.end += runLength(stream.buffer, chunk.end - 1, stream.size) - 1;
+  lexChunk(stream.buffer, chunk, options);
+
+  for(uint32_t close : chunk.closes){
+    if(stream.open.empty()){
+      stream.error = "Error: Unmatched ']' at program counter " + std::to_string(stream.lexed + close);
+      return false;
+    }
+    stream.open.pop_back();
+  }
+  for(uint32_t open : chunk.opens)
+    stream.open.push_back(stream.lexed + open);
+  for(int type=0;type<256;type++)
+    stream.counts[type] += chunk.counts[type];
+  instructions.insert(instructions.end(), chunk.instructions.begin(), chunk.instructions.end());
+  stream.lexed += chunk.instructions.size();
+  stream.position = chunk.end;
+
+  // the pages lexed are not read again, dropping them keeps the resident size to a window
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t done = stream.position / page * page;
+  if(done > stream.released){
+    madvise((void*)(stream.buffer + stream.released), done - stream.released, MADV_DONTNEED);
+    stream.released = done;
+  }
+  return true;
+}
+
+void lexerClose(lexer_stream_t &stream, std::map<InstructionType,uint32_t> &instructions_map) {
+  for(int type=0;type<256;type++)
+    if(stream.counts[type])
+      instructions_map[static_cast<InstructionType>(type)] += stream.counts[type];
+  if(stream.size > 0)
+    munmap((void*)stream.buffer, stream.size);
+}
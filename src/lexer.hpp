@@ -7,16 +7,54 @@
 #include <stack>
 #include <map>
 
+#define LEXER_CHUNK_MIN (256 * 1024) // Bytes of source a lexer thread gets at least, smaller sources use fewer threads
+#define LEXER_WINDOW (1024 * 1024) // Bytes of source lexerNext reads at a time
+
 
 /**
  * @brief This function lexes the Brainfuck source code and returns a vector of instructions.
- * The lexer reads the entire source file, parses the Brainfuck commands, and generates a list of instructions.
+ * The lexer maps the source file, parses the Brainfuck commands, and generates a list of instructions.
  * It also handles the first pass of optimization by merging consecutive commands and removing unnecessary ones.
+ * Comments are skipped and runs counted 16 bytes at a time with SSE2, 32 with AVX2 when the build targets it.
+ * Large sources are split in slices lexed by one thread each, brackets are matched within each slice and then across them,
+ * runs crossing a slice boundary are merged back, so the result is the same as lexing the file in one go.
  * @param options Compiler options structure that include optimization flags.
  * @param instructions_map A map to keep track of the number of each instruction type.
  * @return A vector of instructions representing the parsed Brainfuck code.
  */
-std::vector<Instruction> lexer(CompilerOptions options,std::map<InstructionType,uint16_t> &instructions_map);
+std::vector<Instruction> lexer(CompilerOptions options,std::map<InstructionType,uint32_t> &instructions_map);
+
+/**
+ * @brief a source lexed a window at a time, so the program never has to be held whole.
+ * The windows read are dropped from memory, only the brackets still open are kept.
+ */
+typedef struct{
+  const char *buffer;
+  size_t size;
+  size_t position;              // first byte not lexed yet
+  size_t released;              // bytes of the mapping already given back
+  uint64_t lexed;               // instructions lexed so far, the program counter of the next one
+  std::vector<uint64_t> open;   // program counter of every '[' not closed yet, outermost first
+  uint64_t counts[256];         // instructions by type
+  std::string error;            // set when the source is not a valid program
+}lexer_stream_t;
+
+/**
+ * @brief maps the source file for lexerNext, exits if it cannot be read.
+ */
+void lexerOpen(lexer_stream_t &stream, CompilerOptions &options);
+
+/**
+ * @brief lexes the next LEXER_WINDOW bytes of the source, more when a run crosses the end of the window.
+ * The instructions are appended to instructions, the same ones lexer() returns but with the branches not linked.
+ * @return false once the whole source was lexed, or on an unmatched bracket with stream.error set.
+ */
+bool lexerNext(lexer_stream_t &stream, instructions_list &instructions, CompilerOptions &options);
+
+/**
+ * @brief unmaps the source and adds the instructions lexed to instructions_map.
+ */
+void lexerClose(lexer_stream_t &stream, std::map<InstructionType,uint32_t> &instructions_map);
 
 
 
@@ -0,0 +1,295 @@
+#include "passes.hpp"
+#include "stats.hpp"
+#include <algorithm>
+
+/**
+ * @brief rewrites a loop given its body, the loop itself (BEQZ and BNEQ) is not part of body.
+ * @return true if the loop was replaced by the instructions appended to replacement.
+ */
+typedef bool (*loop_fn)(const Instruction *body, size_t size, instructions_list &replacement);
+
+/**
+ * @brief copies input to output and offers every loop to rewrite once its body is in output.
+ * Loops are closed innermost first, so a rewritten inner loop is already in its final shape when the outer one is checked.
+ */
+static void rewriteLoops(const instructions_list &input, instructions_list &output, loop_fn rewrite) {
+  output.reserve(input.size());
+  std::vector<size_t> open; // index in output of the BEQZ of every open loop
+  instructions_list replacement;
+  for(Instruction i : input){
+    if(i.type==InstructionType::BEQZ){
+      open.push_back(output.size());
+    }
+    else if(i.type==InstructionType::BNEQ && !open.empty()){ // a loop opened in an earlier piece holds a loop, it is kept
+      size_t start = open.back();
+      open.pop_back();
+      replacement.clear();
+      if(rewrite(output.data()+start+1, output.size()-start-1, replacement)){
+        output.resize(start);
+        output.insert(output.end(), replacement.begin(), replacement.end());
+        continue;
+      }
+    }
+    output.push_back(i);
+  }
+}
+
+static Instruction makeInstruction(InstructionType type, uint32_t extra) {
+  Instruction i;
+  i.type = type;
+  i.arg = 0;
+  i.offset = 0;
+  i.extra = extra;
+  return i;
+}
+
+/**
+ * @brief [-] and [+] set the cell to zero.
+ * Thanks to the merging every variant ([--], [+++]) is a loop with a single ADD or SUB.
+ */
+static bool clearLoop(const Instruction *body, size_t size, instructions_list &replacement) {
+  if(size != 1 || (body[0].type != InstructionType::ADD && body[0].type != InstructionType::SUB))
+    return false;
+  replacement.push_back(makeInstruction(InstructionType::MOV0, 0));
+  return true;
+}
+
+static void mov0Pass(const instructions_list &input, instructions_list &output) {
+  rewriteLoops(input, output, clearLoop);
+}
+
+/**
+ * @brief [>], [<] and [>>>>] move until a zero cell, the SCAN holds the signed stride.
+ */
+static bool scanLoop(const Instruction *body, size_t size, instructions_list &replacement) {
+  if(size != 1 || (body[0].type != InstructionType::INC && body[0].type != InstructionType::DEC))
+    return false;
+  int32_t stride = static_cast<int32_t>(body[0].extra);
+  replacement.push_back(makeInstruction(InstructionType::SCAN, static_cast<uint32_t>(body[0].type==InstructionType::INC ? stride : -stride)));
+  return true;
+}
+
+static void scanPass(const instructions_list &input, instructions_list &output) {
+  rewriteLoops(input, output, scanLoop);
+}
+
+/**
+ * @brief tries to turn a loop into a multiply loop.
+ * A loop made only of + - < >, with no net pointer movement and with the current cell changed by exactly 1
+ * runs cell[p] times (or 256-cell[p] when incrementing), so each cell[p+k] ends up increased by m_k * cell[p].
+ * The loop is replaced by a MUL for each target followed by a MOV0 of the current cell.
+ */
+static bool mulLoop(const Instruction *body, size_t size, instructions_list &replacement) {
+  std::map<int32_t,int32_t> deltas; // offset -> total change of the cell at that offset
+  int64_t pointer = 0;
+  for(size_t k=0;k<size;k++){
+    Instruction i = body[k];
+    switch(i.type){
+      case InstructionType::ADD:
+        deltas[pointer] += i.extra;
+      break;
+      case InstructionType::SUB:
+        deltas[pointer] -= i.extra;
+      break;
+      case InstructionType::INC:
+        pointer += i.extra;
+      break;
+      case InstructionType::DEC:
+        pointer -= i.extra;
+      break;
+      default:
+        return false; // I/O, nested loops or already optimized code
+    }
+    if(pointer > INT32_MAX || pointer < INT32_MIN)
+      return false;
+  }
+  uint8_t step = static_cast<uint8_t>(deltas[0]);
+  if(pointer != 0 || (step != 1 && step != 255))
+    return false;
+
+  for(auto &pair : deltas){
+    uint8_t factor = static_cast<uint8_t>(pair.second);
+    if(pair.first == 0 || factor == 0)
+      continue;
+    Instruction mul = makeInstruction(InstructionType::MUL, static_cast<uint32_t>(pair.first));
+    mul.arg = step == 255 ? factor : static_cast<uint8_t>(-factor); // counting up means the loop runs -cell[p] times
+    replacement.push_back(mul);
+  }
+  replacement.push_back(makeInstruction(InstructionType::MOV0, 0));
+  return true;
+}
+
+static void mulPass(const instructions_list &input, instructions_list &output) {
+  rewriteLoops(input, output, mulLoop);
+}
+
+/**
+ * @brief sinks the pointer moves of straight-line code into the offset of the instructions.
+ * Between two loop boundaries every ADD, SUB, MOV0, OUTPUT, INPUT and MUL gets the distance from the tape pointer
+ * at the start of the block, and the INC/DEC are merged into a single move emitted before the next BEQZ, BNEQ or SCAN.
+ * So >+>++<<- becomes add [p+1],1 add [p+2],2 sub [p],1 with no pointer move at all.
+ */
+static void offsetPass(const instructions_list &input, instructions_list &output) {
+  output.reserve(input.size());
+  int64_t pending = 0; // pointer movement not emitted yet
+
+  auto flush = [&]() {
+    if(pending == 0)
+      return;
+    output.push_back(makeInstruction(pending > 0 ? InstructionType::INC : InstructionType::DEC,
+                                     static_cast<uint32_t>(pending > 0 ? pending : -pending)));
+    pending = 0;
+  };
+
+  for(Instruction i : input){
+    switch(i.type){
+      case InstructionType::INC:
+        pending += i.extra;
+      break;
+      case InstructionType::DEC:
+        pending -= i.extra;
+      break;
+      case InstructionType::ADD:
+      case InstructionType::SUB:
+      case InstructionType::MOV0:
+      case InstructionType::OUTPUT:
+      case InstructionType::INPUT:
+      case InstructionType::MUL:{
+        int64_t offset = pending + i.offset;
+        int64_t target = offset + static_cast<int32_t>(i.extra);
+        if(offset < INT16_MIN || offset > INT16_MAX ||
+           (i.type == InstructionType::MUL && (target < INT32_MIN || target > INT32_MAX))){
+          flush();
+          offset = i.offset;
+        }
+        i.offset = static_cast<int16_t>(offset);
+        output.push_back(i);
+      }
+      break;
+      default: // loop boundaries and scans need the real pointer
+        flush();
+        output.push_back(i);
+      break;
+    }
+    if(pending > INT32_MAX || pending < INT32_MIN)
+      flush();
+  }
+  // nothing reads the pointer after the last instruction, the pending move can be dropped
+}
+
+const std::vector<Pass> passes = {
+  {"mov0",   "[-] and [+] -> mov 0",                                   mov0Pass},
+  {"scan",   "[>] and [<<<] -> scan",                                  scanPass},
+  {"mul",    "[->+>---<<] and other balanced loops -> mul ... mov 0", mulPass},
+  {"offset", "pointer moves between loops -> instruction offsets",     offsetPass},
+};
+
+bool isPass(const std::string &name) {
+  for(const Pass &pass : passes)
+    if(name == pass.name)
+      return true;
+  return false;
+}
+
+void linkBranches(instructions_list &instructions) {
+  std::vector<uint32_t> open;
+  for(size_t k=0;k<instructions.size();k++){
+    if(instructions[k].type==InstructionType::BEQZ){
+      open.push_back(k);
+    }
+    else if(instructions[k].type==InstructionType::BNEQ){
+      instructions[k].extra = open.back();
+      instructions[open.back()].extra = k;
+      open.pop_back();
+    }
+  }
+}
+
+void runPasses(instructions_list &instructions, CompilerOptions options, std::map<InstructionType,uint32_t> &instructions_map,
+               std::vector<uint32_t> *loop_origins) {
+  verbose(options, "Starting compiler passes for optimization.");
+  if(loop_origins){
+    // passes copy the loops they keep as they are, number them while nothing reads the branch addresses
+    uint32_t loop = 0;
+    for(Instruction &i : instructions)
+      if(i.type==InstructionType::BEQZ)
+        i.extra = loop++;
+  }
+  instructions_list output;
+  for(const Pass &pass : passes){
+    if(options.disabled_passes.count(pass.name)){
+      verbose(options, std::string("Pass ") + pass.name + " disabled.");
+      continue;
+    }
+    output.clear();
+    stats_clock_t start = statsStart();
+    pass.run(instructions, output);
+    stats.passes.push_back({pass.name, instructions.size(), output.size(), statsElapsed(start)});
+    verbose(options, std::string("Pass ") + pass.name + ": " + std::to_string(instructions.size()) + " -> "
+                     + std::to_string(output.size()) + " instructions.");
+    instructions.swap(output);
+  }
+  if(loop_origins){
+    loop_origins->clear();
+    for(Instruction i : instructions)
+      if(i.type==InstructionType::BEQZ)
+        loop_origins->push_back(i.extra);
+  }
+  linkBranches(instructions);
+
+  // passes change the instruction mix, the JIT sizes its buffer on these counts
+  for(auto &pair : instructions_map)
+    pair.second = 0;
+  for(Instruction i : instructions)
+    instructions_map[i.type]++;
+}
+
+size_t passesCut(pass_cut_t &cut, const instructions_list &waiting, size_t limit, bool &flush) {
+  size_t end = 0;
+  for(;cut.scanned<waiting.size();cut.scanned++){
+    InstructionType type = waiting[cut.scanned].type;
+    if(type==InstructionType::BNEQ){
+      if(cut.kept.back())
+        end = cut.scanned + 1;
+      cut.kept.pop_back();
+    }
+    else if(!cut.kept.empty() && type!=InstructionType::ADD && type!=InstructionType::SUB &&
+            type!=InstructionType::INC && type!=InstructionType::DEC)
+      cut.kept.back() = true; // rewritten loops are made of + - < > only
+    if(type==InstructionType::BEQZ)
+      cut.kept.push_back(false);
+    if(cut.kept.empty() || cut.kept.back())
+      cut.safe = cut.scanned + 1;
+  }
+  flush = false;
+  if(waiting.size() - end > limit && cut.safe > end){
+    end = cut.safe;
+    flush = true;
+  }
+  cut.scanned -= end;
+  cut.safe = cut.safe > end ? cut.safe - end : 0;
+  return end;
+}
+
+void runPassesPiece(instructions_list &instructions, instructions_list &scratch, CompilerOptions &options, bool flush) {
+  if(flush) // the offset pass writes the pending move before an instruction it does not know
+    instructions.push_back(makeInstruction(InstructionType::UNKNOWN, 0));
+  for(const Pass &pass : passes){
+    if(options.disabled_passes.count(pass.name))
+      continue;
+    scratch.clear();
+    stats_clock_t start = statsStart();
+    pass.run(instructions, scratch);
+    double ms = statsElapsed(start);
+    // one entry per pass for the whole program, not per piece
+    auto entry = std::find_if(stats.passes.begin(), stats.passes.end(), [&](const stats_pass_t &p){ return p.name == pass.name; });
+    if(entry == stats.passes.end())
+      entry = stats.passes.insert(stats.passes.end(), {pass.name, 0, 0, 0});
+    entry->before += instructions.size();
+    entry->after += scratch.size();
+    entry->ms += ms;
+    instructions.swap(scratch);
+  }
+  if(flush)
+    instructions.pop_back();
+}
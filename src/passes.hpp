@@ -0,0 +1,78 @@
+#ifndef PASSES_H
+#define PASSES_H
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include "utils.hpp"
+
+/**
+ * @brief a pass reads the whole program and writes the optimized one into output.
+ * Passes never edit the input in place, each one rebuilds the program in a single walk so the cost stays linear.
+ * The branch addresses in the extra of BEQZ and BNEQ are only valid in the input of the first pass,
+ * they are linked again once all passes ran.
+ * A pass may also get a piece of the program, see runPassesPiece.
+ */
+typedef void (*pass_fn)(const instructions_list &input, instructions_list &output);
+
+typedef struct{
+  const char *name;         // -fno-<name> disables the pass
+  const char *description;
+  pass_fn run;
+}Pass;
+
+/**
+ * @brief the passes run by runPasses, in order.
+ */
+extern const std::vector<Pass> passes;
+
+/**
+ * @brief returns true if name is the name of a pass, used to validate -fno-<pass>.
+ */
+bool isPass(const std::string &name);
+
+/**
+ * @brief runs every pass not disabled in options, then links the branches and recounts instructions_map.
+ * @param instructions The program, replaced by the optimized one.
+ * @param options Compiler options, holds the disabled passes.
+ * @param instructions_map The number of each instruction type, the JIT sizes its buffer on these counts.
+ * @param loop_origins If not NULL, receives for every loop left, in order, the index of its '[' among the loops of the source.
+ */
+void runPasses(instructions_list &instructions, CompilerOptions options, std::map<InstructionType,uint32_t> &instructions_map,
+               std::vector<uint32_t> *loop_origins = NULL);
+
+/**
+ * @brief where a program lexed a piece at a time can be cut before runPassesPiece, see passesCut.
+ */
+typedef struct{
+  std::vector<bool> kept;   // for every loop open, whether no pass can rewrite it: it holds a loop or I/O
+  size_t scanned = 0;       // instructions of the waiting code already looked at
+  size_t safe = 0;          // end of the waiting code the furthest out of any loop a pass could rewrite
+}pass_cut_t;
+
+/**
+ * @brief returns how many of the instructions waiting for the passes make the next piece, 0 to wait for more code.
+ * A piece ends right after a loop no pass rewrites. No pointer move is pending there and no loop around the cut can be
+ * rewritten, so the passes give the same result as on the whole program.
+ * When more than limit instructions wait without such an end, they are cut anywhere out of the loops a pass could rewrite
+ * and flush is set: the pointer move pending at the cut has to be written there.
+ * The caller removes the piece from waiting before the next call.
+ */
+size_t passesCut(pass_cut_t &cut, const instructions_list &waiting, size_t limit, bool &flush);
+
+/**
+ * @brief runs every pass not disabled in options on a piece of the program cut by passesCut, the stats add up over the pieces.
+ * The branches are not linked, the instruction counts are left to the caller.
+ * @param instructions The piece, replaced by the optimized one.
+ * @param scratch Buffer reused from piece to piece.
+ * @param flush The piece does not end after a loop, the pointer move pending at its end is written.
+ */
+void runPassesPiece(instructions_list &instructions, instructions_list &scratch, CompilerOptions &options, bool flush = false);
+
+/**
+ * @brief sets the extra of every BEQZ to the index of its BNEQ and the other way around.
+ * This is the loop tree of the program: any loop can be skipped or walked without a stack.
+ */
+void linkBranches(instructions_list &instructions);
+
+#endif
@@ -0,0 +1,183 @@
+#include "perfmap.hpp"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/**
+ * @brief the header of a jitdump file, as perf expects it.
+ */
+typedef struct{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t total_size;
+  uint32_t elf_mach;
+  uint32_t pad1;
+  uint32_t pid;
+  uint64_t timestamp;
+  uint64_t flags;
+}jitdump_header_t;
+
+/**
+ * @brief a JIT_CODE_LOAD record of a jitdump, followed by the name, its null and the code.
+ */
+typedef struct{
+  uint32_t id;
+  uint32_t total_size;
+  uint64_t timestamp;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t code_addr;
+  uint64_t code_size;
+  uint64_t code_index;
+}jitdump_load_t;
+
+/**
+ * @brief the clock of the jitdump timestamps, perf record has to sample with -k mono for perf inject to match them.
+ */
+static uint64_t monotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+void perfMapOpen(perf_map_t &perf_map, CompilerOptions options, uint16_t elf_machine) {
+  std::string pid = std::to_string(getpid());
+  std::string map_name = "/tmp/perf-" + pid + ".map";
+  perf_map.map = fopen(map_name.c_str(), "w");
+  if(perf_map.map == NULL){
+    std::cerr << "Error: Could not write perf map '" << map_name << "'." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  perf_map.dump = NULL;
+  perf_map.marker = NULL;
+  perf_map.code_index = 0;
+  perf_map.loop_names.clear();
+  verbose(options, "Writing symbols to " + map_name + ".");
+  if(!options.jitdump)
+    return;
+
+  std::string dump_name = "/tmp/jit-" + pid + ".dump";
+  perf_map.dump = fopen(dump_name.c_str(), "w+");
+  if(perf_map.dump == NULL){
+    std::cerr << "Error: Could not write jitdump '" << dump_name << "'." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  jitdump_header_t header = {PERFMAP_JITDUMP_MAGIC, PERFMAP_JITDUMP_VERSION, sizeof(jitdump_header_t), elf_machine, 0,
+                             static_cast<uint32_t>(getpid()), monotonicNs(), 0};
+  fwrite(&header, sizeof(header), 1, perf_map.dump);
+  fflush(perf_map.dump);
+  // perf record sees this executable mapping of the file and perf inject --jit reads the records from it
+  perf_map.marker = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE, fileno(perf_map.dump), 0);
+  if(perf_map.marker == MAP_FAILED){
+    std::cerr << "Warning: Could not map the jitdump, perf will not find it: " << strerror(errno) << std::endl;
+    perf_map.marker = NULL;
+  }
+  verbose(options, "Writing code to " + dump_name + ".");
+}
+
+void perfMapSymbol(perf_map_t &perf_map, const uint8_t *address, size_t size, const std::string &name) {
+  if(size == 0)
+    return;
+  fprintf(perf_map.map, "%lx %lx %s\n", reinterpret_cast<uintptr_t>(address), size, name.c_str());
+  if(perf_map.dump == NULL)
+    return;
+  jitdump_load_t load;
+  load.id = 0; // JIT_CODE_LOAD
+  load.total_size = static_cast<uint32_t>(sizeof(load) + name.size() + 1 + size);
+  load.timestamp = monotonicNs();
+  load.pid = static_cast<uint32_t>(getpid());
+  load.tid = static_cast<uint32_t>(syscall(SYS_gettid));
+  load.vma = reinterpret_cast<uintptr_t>(address);
+  load.code_addr = load.vma;
+  load.code_size = size;
+  load.code_index = perf_map.code_index++;
+  fwrite(&load, sizeof(load), 1, perf_map.dump);
+  fwrite(name.c_str(), name.size() + 1, 1, perf_map.dump);
+  fwrite(address, size, 1, perf_map.dump);
+}
+
+/**
+ * @brief returns the pattern of the loop starting at begin, the kind of work the passes left in its body.
+ */
+static std::string loopPattern(const instructions_list &instructions, size_t begin) {
+  bool mul = false, scan = false, io = false, clear = false;
+  for(size_t k=begin+1;k<instructions[begin].extra;k++){
+    switch(instructions[k].type){
+      case InstructionType::BEQZ:
+        return "nested";
+      case InstructionType::MUL:
+        mul = true;
+      break;
+      case InstructionType::SCAN:
+        scan = true;
+      break;
+      case InstructionType::INPUT:
+      case InstructionType::OUTPUT:
+        io = true;
+      break;
+      case InstructionType::MOV0:
+        clear = true;
+      break;
+      default:
+      break;
+    }
+  }
+  return mul ? "addto" : scan ? "scan" : io ? "io" : clear ? "clear" : "inner";
+}
+
+/**
+ * @brief returns the offset right after the ']' closing the '[' at offset in source.
+ */
+static size_t closingBracket(const std::string &source, size_t offset) {
+  int depth = 0;
+  for(size_t k=offset;k<source.size();k++){
+    depth += source[k]=='[' ? 1 : source[k]==']' ? -1 : 0;
+    if(depth == 0)
+      return k + 1;
+  }
+  return source.size();
+}
+
+void perfMapProgram(perf_map_t &perf_map, const uint8_t *code, size_t code_size, const instructions_list &instructions,
+                    const profile_t &loops, const std::vector<uint32_t> &addresses, CompilerOptions options) {
+  std::string source = profileSource(options);
+  std::vector<size_t> brackets = profileBrackets(source);
+  size_t end = instructions.size();
+  perfMapSymbol(perf_map, code, addresses[0], "bf_start");
+  size_t block = 0;   // first instruction of the top level code since the last loop
+  size_t after = 0;   // source offset of that code
+  for(size_t pc=0;pc<end;pc++){
+    if(instructions[pc].type != InstructionType::BEQZ)
+      continue;
+    perfMapSymbol(perf_map, code + addresses[block], addresses[pc] - addresses[block], std::string("block@") + profilePosition(source, after));
+    size_t loop = std::lower_bound(loops.loops.begin(), loops.loops.end(), pc) - loops.loops.begin();
+    std::string name = "loop@?";
+    if(loops.origins[loop] < brackets.size()){
+      size_t offset = brackets[loops.origins[loop]];
+      name = std::string("loop@") + profilePosition(source, offset);
+      after = closingBracket(source, offset);
+    }
+    name += "_";
+    name += loopPattern(instructions, pc);
+    perf_map.loop_names[pc] = name;
+    size_t exit = instructions[pc].extra + 1;
+    perfMapSymbol(perf_map, code + addresses[pc], addresses[exit] - addresses[pc], name);
+    pc = exit - 1;
+    block = exit;
+  }
+  perfMapSymbol(perf_map, code + addresses[block], addresses[end] - addresses[block], std::string("block@") + profilePosition(source, after));
+  perfMapSymbol(perf_map, code + addresses[end], code_size - addresses[end], "bf_exit");
+}
+
+void perfMapClose(perf_map_t &perf_map) {
+  fclose(perf_map.map);
+  if(perf_map.dump == NULL)
+    return;
+  if(perf_map.marker)
+    munmap(perf_map.marker, sysconf(_SC_PAGESIZE));
+  fclose(perf_map.dump);
+}
@@ -0,0 +1,51 @@
+#ifndef PERFMAP_H
+#define PERFMAP_H
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include "utils.hpp"
+#include "profile.hpp"
+
+#define PERFMAP_JITDUMP_MAGIC 0x4A695444 // "JiTD" read as a little endian word
+#define PERFMAP_JITDUMP_VERSION 1
+
+/**
+ * @brief the symbol files of --perf-map being written: /tmp/perf-<pid>.map and, with --jitdump, /tmp/jit-<pid>.dump.
+ */
+typedef struct{
+  FILE *map;
+  FILE *dump;                               // NULL without --jitdump
+  void *marker;                             // the mapping of the dump perf record looks for
+  uint64_t code_index;                      // records of the dump so far
+  std::map<uint32_t,std::string> loop_names; // names of the top level loops, by their BEQZ
+}perf_map_t;
+
+/**
+ * @brief creates the map, and the jitdump with its header when options.jitdump is set.
+ * @param elf_machine The e_machine of the host, the jitdump header carries it.
+ */
+void perfMapOpen(perf_map_t &perf_map, CompilerOptions options, uint16_t elf_machine);
+
+/**
+ * @brief adds a symbol for the size bytes of code at address, a code load record to the jitdump with a copy of them.
+ */
+void perfMapSymbol(perf_map_t &perf_map, const uint8_t *address, size_t size, const std::string &name);
+
+/**
+ * @brief names the code of the program after the source: one symbol per top level loop, loop@<line>:<column>_<pattern>,
+ * and one per run of top level code between them, block@<line>:<column>. The pattern is what the passes left in the loop:
+ * nested, addto for multiply loops, scan, io, clear or inner for any other innermost loop.
+ * @param loops The loops of instructions and their origins, from profileInit.
+ * @param addresses The code offset of every top level instruction, filled in by jitCompile.
+ * @param code_size The end of the program, the exit code follows addresses[instructions.size()].
+ */
+void perfMapProgram(perf_map_t &perf_map, const uint8_t *code, size_t code_size, const instructions_list &instructions,
+                    const profile_t &loops, const std::vector<uint32_t> &addresses, CompilerOptions options);
+
+/**
+ * @brief closes the files. The map stays in /tmp for perf report, the jitdump for perf inject --jit.
+ */
+void perfMapClose(perf_map_t &perf_map);
+
+#endif
@@ -0,0 +1,174 @@
+#include "profile.hpp"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <map>
+
+void profileInit(profile_t &profile, const instructions_list &instructions, const std::vector<uint32_t> &loop_origins) {
+  profile.loops.clear();
+  for(size_t k=0;k<instructions.size();k++)
+    if(instructions[k].type==InstructionType::BEQZ)
+      profile.loops.push_back(k);
+  profile.origins = loop_origins;
+  if(profile.origins.empty())
+    for(uint32_t k=0;k<profile.loops.size();k++)
+      profile.origins.push_back(k);
+  profile.counters.assign(profile.loops.size(), {0, 0});
+}
+
+uint8_t profileHeat(const profile_t *profile, size_t pc) {
+  if(profile == NULL || profile->heat.empty())
+    return LOOP_WARM;
+  auto loop = std::lower_bound(profile->loops.begin(), profile->loops.end(), pc);
+  return profile->heat[loop - profile->loops.begin()];
+}
+
+loop_counter_t* profileCounter(profile_t &profile, size_t pc) {
+  auto loop = std::lower_bound(profile.loops.begin(), profile.loops.end(), pc);
+  return &profile.counters[loop - profile.loops.begin()];
+}
+
+/**
+ * @brief returns the instructions of the body of the loop starting at begin, skipping the inner loops.
+ */
+static uint64_t ownInstructions(const instructions_list &instructions, size_t begin) {
+  uint64_t count = 0;
+  for(size_t k=begin+1;k<instructions[begin].extra;k++){
+    count++;
+    if(instructions[k].type==InstructionType::BEQZ)
+      k = instructions[k].extra;
+  }
+  return count;
+}
+
+std::string profileSource(CompilerOptions options) {
+  std::ifstream file(options.source_file_name, std::ios::binary);
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  return buffer.str();
+}
+
+/**
+ * @brief FNV-1a, 64 bits.
+ */
+static uint64_t sourceHash(const std::string &source) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for(unsigned char c : source){
+    hash ^= c;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+void profileSave(const profile_t &profile, CompilerOptions options) {
+  std::string source = profileSource(options);
+  std::ofstream file(options.profile_out);
+  if(!file){
+    std::cerr << "Error: Could not write profile file '" << options.profile_out << "'." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  file << "source " << source.size() << " " << std::hex << sourceHash(source) << std::dec << "\n";
+  file << "loops " << profile.loops.size() << "\n";
+  for(size_t l=0;l<profile.loops.size();l++)
+    file << profile.origins[l] << " " << profile.counters[l].entries << " " << profile.counters[l].iterations << "\n";
+  verbose(options, "Profile saved to " + options.profile_out + ".");
+}
+
+bool profileLoad(profile_t &profile, const instructions_list &instructions, CompilerOptions options) {
+  std::ifstream file(options.profile_use);
+  std::string source = profileSource(options);
+  std::string tag;
+  size_t size = 0, count = 0;
+  uint64_t hash = 0;
+  if(!(file >> tag >> size >> std::hex >> hash >> std::dec) || tag != "source" || !(file >> tag >> count) || tag != "loops"){
+    std::cerr << "Warning: '" << options.profile_use << "' is not a profile file, ignored." << std::endl;
+    return false;
+  }
+  if(size != source.size() || hash != sourceHash(source)){
+    std::cerr << "Warning: '" << options.profile_use << "' was taken on another source, ignored." << std::endl;
+    return false;
+  }
+  std::map<uint32_t,loop_counter_t> counters; // by origin
+  uint32_t origin;
+  loop_counter_t c;
+  for(size_t k=0;k<count && file >> origin >> c.entries >> c.iterations;k++)
+    counters[origin] = c;
+
+  // the loops left by these passes, with the estimated cycles of the ones the profile knows
+  std::vector<uint64_t> cycles(profile.loops.size(), 0);
+  uint64_t total = 0;
+  profile.heat.assign(profile.loops.size(), LOOP_WARM);
+  for(size_t l=0;l<profile.loops.size();l++){
+    auto found = counters.find(profile.origins[l]);
+    if(found == counters.end())
+      continue;
+    cycles[l] = found->second.iterations * (ownInstructions(instructions, profile.loops[l]) + 1);
+    total += cycles[l];
+    if(found->second.entries == 0)
+      profile.heat[l] = LOOP_COLD;
+  }
+  size_t hot = 0, cold = 0;
+  for(size_t l=0;l<profile.loops.size();l++){
+    auto found = counters.find(profile.origins[l]);
+    if(found != counters.end() && cycles[l] > 0 && cycles[l] >= PROFILE_HOT_SHARE * total &&
+       found->second.iterations >= PROFILE_HOT_TRIP * found->second.entries){
+      profile.heat[l] = LOOP_HOT;
+      hot++;
+    }
+    cold += profile.heat[l] == LOOP_COLD;
+  }
+  verbose(options, "Profile " + options.profile_use + ": " + std::to_string(hot) + " hot and " + std::to_string(cold) + " cold loops of " + std::to_string(profile.loops.size()) + ".");
+  return true;
+}
+
+std::vector<size_t> profileBrackets(const std::string &source) {
+  std::vector<size_t> brackets;
+  for(size_t k=0;k<source.size();k++)
+    if(source[k]=='[')
+      brackets.push_back(k);
+  return brackets;
+}
+
+std::string profilePosition(const std::string &source, size_t offset) {
+  size_t line_start = offset == 0 ? std::string::npos : source.rfind('\n', offset - 1);
+  line_start = line_start == std::string::npos ? 0 : line_start + 1;
+  return std::to_string(std::count(source.begin(), source.begin() + offset, '\n') + 1) + ":" + std::to_string(offset - line_start + 1);
+}
+
+void profileReport(const profile_t &profile, const instructions_list &instructions, CompilerOptions options) {
+  std::string source = profileSource(options);
+  std::vector<size_t> brackets = profileBrackets(source);
+
+  std::vector<uint64_t> cycles(profile.loops.size());
+  uint64_t total = 0;
+  std::vector<size_t> ranked;
+  for(size_t l=0;l<profile.loops.size();l++){
+    const loop_counter_t &c = profile.counters[l];
+    cycles[l] = c.iterations * (ownInstructions(instructions, profile.loops[l]) + 1);
+    total += cycles[l];
+    if(c.entries)
+      ranked.push_back(l);
+  }
+  std::stable_sort(ranked.begin(), ranked.end(), [&](size_t a, size_t b){
+    return profile.counters[a].iterations > profile.counters[b].iterations;
+  });
+
+  fprintf(stderr, "Loop profile: %zu loops, %zu run, %lu estimated cycles in loops.\n", profile.loops.size(), ranked.size(), total);
+  fprintf(stderr, "%-12s %14s %14s %12s %16s %7s  %s\n", "line:col", "entries", "iterations", "iter/entry", "est. cycles", "share", "source");
+  for(size_t r=0;r<ranked.size() && r<PROFILE_TOP_LOOPS;r++){
+    size_t l = ranked[r];
+    const loop_counter_t &c = profile.counters[l];
+    std::string position = "?";
+    std::string text;
+    if(profile.origins[l] < brackets.size()){
+      size_t offset = brackets[profile.origins[l]];
+      position = profilePosition(source, offset);
+      for(size_t k=offset;k<source.size() && text.size()<40;k++)
+        if(strchr("+-<>[].,", source[k]))
+          text += source[k];
+    }
+    fprintf(stderr, "%-12s %14lu %14lu %12.1f %16lu %6.1f%%  %s\n", position.c_str(), c.entries, c.iterations,
+            static_cast<double>(c.iterations) / c.entries, cycles[l], total ? 100.0 * cycles[l] / total : 0.0, text.c_str());
+  }
+}
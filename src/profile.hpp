@@ -0,0 +1,91 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+#include <iostream>
+#include <string>
+#include <vector>
+#include "utils.hpp"
+
+#define PROFILE_TOP_LOOPS 10 // Loops listed by the report
+#define PROFILE_HOT_SHARE 0.01 // Share of the estimated cycles making a loop hot for --profile-use
+#define PROFILE_HOT_TRIP 4 // Iterations per entry a hot loop needs, shorter loops gain nothing from unrolling
+
+/**
+ * @brief what --profile-use made of a loop.
+ */
+enum loop_heat_t : uint8_t {
+  LOOP_COLD,  // never ran: no register cache, the smallest code
+  LOOP_WARM,  // compiled as without a profile, also the loops the profile knows nothing about
+  LOOP_HOT    // innermost ones are aligned and unrolled twice
+};
+
+/**
+ * @brief the counters of a loop, incremented by the JIT code.
+ */
+typedef struct{
+  uint64_t entries;     // times the [ ran, the loop may have been skipped
+  uint64_t iterations;  // times the body ran
+}loop_counter_t;
+
+/**
+ * @brief the loops of a program and their counters, a loop id is the order of its BEQZ in the program.
+ */
+typedef struct{
+  std::vector<uint32_t> loops;            // index of the BEQZ of every loop
+  std::vector<uint32_t> origins;          // index of the '[' of every loop among the ones of the source
+  std::vector<loop_counter_t> counters;
+  bool instrument = false;                // the JIT code bumps the counters
+  std::vector<uint8_t> heat;              // loop_heat_t of every loop, empty without --profile-use
+}profile_t;
+
+/**
+ * @brief lists the loops of instructions and zeroes their counters.
+ * @param loop_origins The origins filled in by runPasses, empty when no pass ran and every '[' is still a loop.
+ */
+void profileInit(profile_t &profile, const instructions_list &instructions, const std::vector<uint32_t> &loop_origins);
+
+/**
+ * @brief returns the counters of the loop whose BEQZ is at pc.
+ */
+loop_counter_t* profileCounter(profile_t &profile, size_t pc);
+
+/**
+ * @brief returns the contents of the source file, empty if it can not be read.
+ */
+std::string profileSource(CompilerOptions options);
+
+/**
+ * @brief returns the offset of every '[' of source, the origin of a loop indexes it.
+ */
+std::vector<size_t> profileBrackets(const std::string &source);
+
+/**
+ * @brief returns "line:column" of offset in source, both from 1.
+ */
+std::string profilePosition(const std::string &source, size_t offset);
+
+/**
+ * @brief loop_heat_t of the loop whose BEQZ is at pc, LOOP_WARM when there is no profile.
+ */
+uint8_t profileHeat(const profile_t *profile, size_t pc);
+
+/**
+ * @brief writes the counters to options.profile_out, by the origin of each loop so they apply to any set of passes.
+ * The file starts with the size and the FNV-1a hash of the source, a profile is only used on the program it was taken on.
+ */
+void profileSave(const profile_t &profile, CompilerOptions options);
+
+/**
+ * @brief reads options.profile_use and sets the heat of the loops.
+ * A loop is hot when it takes PROFILE_HOT_SHARE of the estimated cycles, cold when it never ran.
+ * @return false, after a warning on stderr, if the file is missing or was taken on another source, the heat is then left empty.
+ */
+bool profileLoad(profile_t &profile, const instructions_list &instructions, CompilerOptions options);
+
+/**
+ * @brief prints to stderr the loops with the most iterations, with their position and text in the source.
+ * The estimated cycles of a loop are its iterations times the instructions of its body, not counting inner loops,
+ * plus one for the branch: a rough cost that ranks loops by the work they do.
+ */
+void profileReport(const profile_t &profile, const instructions_list &instructions, CompilerOptions options);
+
+#endif
@@ -0,0 +1,78 @@
+#include "stats.hpp"
+#include <sys/resource.h>
+
+stats_t stats;
+
+/**
+ * @brief returns the name of the backend options selects, as main picks it.
+ */
+static std::string statsMode(CompilerOptions options) {
+  if(options.tiered)
+    return "tiered";
+  if(options.interp)
+    return "interpreter";
+  if(options.elf)
+    return "elf";
+  if(options.lazy)
+    return "lazy";
+  if(options.jit)
+    return "jit";
+  return "assembly";
+}
+
+/**
+ * @brief returns s quoted as a JSON string.
+ */
+static std::string jsonString(const std::string &s) {
+  std::string quoted = "\"";
+  for(char c : s){
+    if(c == '"' || c == '\\')
+      quoted += '\\';
+    if(static_cast<unsigned char>(c) < 0x20){
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+      quoted += escape;
+    }
+    else
+      quoted += c;
+  }
+  return quoted + "\"";
+}
+
+void statsReport(CompilerOptions options) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  uint64_t peak_rss = usage.ru_maxrss; // kilobytes on Linux
+  double total = 0;
+  for(auto &phase : stats.phases)
+    total += phase.second;
+
+  if(options.stats_json){
+    fprintf(stderr, "{\"source\": %s, \"mode\": \"%s\", \"phases_ms\": [", jsonString(options.source_file_name).c_str(), statsMode(options).c_str());
+    for(size_t k=0;k<stats.phases.size();k++)
+      fprintf(stderr, "%s{\"name\": \"%s\", \"ms\": %.3f}", k ? ", " : "", stats.phases[k].first.c_str(), stats.phases[k].second);
+    fprintf(stderr, "], \"total_ms\": %.3f, \"lexed\": %lu, \"passes\": [", total, stats.lexed);
+    for(size_t k=0;k<stats.passes.size();k++)
+      fprintf(stderr, "%s{\"name\": \"%s\", \"before\": %lu, \"after\": %lu, \"ms\": %.3f}", k ? ", " : "",
+              stats.passes[k].name.c_str(), stats.passes[k].before, stats.passes[k].after, stats.passes[k].ms);
+    fprintf(stderr, "], \"evaluated\": %lu, \"instructions\": %lu, \"code_estimate\": %lu, \"code_bytes\": %lu, \"tape\": %lu, \"peak_rss_kb\": %lu}\n",
+            stats.evaluated, stats.instructions, stats.code_estimate, stats.code_bytes, options.max_memory, peak_rss);
+    return;
+  }
+  fprintf(stderr, "Stats for %s (%s):\n", options.source_file_name.c_str(), statsMode(options).c_str());
+  for(auto &phase : stats.phases)
+    fprintf(stderr, "  %-22s %12.3f ms\n", phase.first.c_str(), phase.second);
+  fprintf(stderr, "  %-22s %12.3f ms\n", "total", total);
+  fprintf(stderr, "  %-22s %12lu\n", "lexed instructions", stats.lexed);
+  for(auto &pass : stats.passes)
+    fprintf(stderr, "    pass %-17s %12lu -> %lu, %.3f ms\n", pass.name.c_str(), pass.before, pass.after, pass.ms);
+  if(stats.evaluated)
+    fprintf(stderr, "  %-22s %12lu\n", "evaluated at compile", stats.evaluated);
+  fprintf(stderr, "  %-22s %12lu\n", "final instructions", stats.instructions);
+  if(stats.code_estimate){
+    fprintf(stderr, "  %-22s %12lu bytes, %lu estimated (%.1f%%)\n", "machine code", stats.code_bytes, stats.code_estimate,
+            100.0 * stats.code_bytes / stats.code_estimate);
+  }
+  fprintf(stderr, "  %-22s %12lu cells\n", "tape", options.max_memory);
+  fprintf(stderr, "  %-22s %12lu KB\n", "peak RSS", peak_rss);
+}
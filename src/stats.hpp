@@ -0,0 +1,63 @@
+#ifndef STATS_H
+#define STATS_H
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "utils.hpp"
+
+typedef std::chrono::steady_clock::time_point stats_clock_t;
+
+/**
+ * @brief a pass as run by runPasses.
+ */
+typedef struct{
+  std::string name;
+  uint64_t before;  // instructions it was given
+  uint64_t after;   // instructions it left
+  double ms;
+}stats_pass_t;
+
+/**
+ * @brief what a run of the compiler cost, filled in by every stage as it goes and printed by --stats.
+ */
+typedef struct{
+  std::vector<std::pair<std::string,double>> phases; // wall time of every phase in milliseconds, in the order they ran
+  std::vector<stats_pass_t> passes;
+  uint64_t lexed = 0;         // instructions out of the lexer
+  uint64_t evaluated = 0;     // instructions run at compile time
+  uint64_t instructions = 0;  // instructions handed to the backend
+  uint64_t code_estimate = 0; // bytes the code buffers were sized for, from the instruction counts
+  uint64_t code_bytes = 0;    // bytes of machine code emitted
+}stats_t;
+
+extern stats_t stats;
+
+/**
+ * @brief returns the current time, the start of a phase.
+ */
+inline stats_clock_t statsStart() {
+  return std::chrono::steady_clock::now();
+}
+
+/**
+ * @brief returns the milliseconds elapsed since start.
+ */
+inline double statsElapsed(stats_clock_t start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief records the phase name as lasting from start to now.
+ */
+inline void statsPhase(const std::string &name, stats_clock_t start) {
+  stats.phases.push_back({name, statsElapsed(start)});
+}
+
+/**
+ * @brief prints the stats on stderr, as text with --stats or as a JSON object with --stats-json.
+ * Peak RSS is read at this point, so it covers the whole run.
+ */
+void statsReport(CompilerOptions options);
+
+#endif
@@ -0,0 +1,168 @@
+#include "trace.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <algorithm>
+
+void traceOpen(trace_t &trace, const std::string &file_name, uint64_t capacity) {
+  size_t size = sizeof(trace_header_t) + capacity * sizeof(trace_record_t);
+  trace.fd = open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (trace.fd < 0 || ftruncate(trace.fd, size) != 0) {
+    std::cerr << "Error opening debug file: " << file_name << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, trace.fd, 0);
+  if (map == MAP_FAILED) {
+    std::cerr << "Error! Memory mapping of the debug file failed: " << strerror(errno) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  trace.header = (trace_header_t*)map;
+  trace.records = (trace_record_t*)(trace.header + 1);
+  memcpy(trace.header->magic, TRACE_MAGIC, 4);
+  trace.header->version = TRACE_VERSION;
+  trace.header->capacity = capacity;
+  trace.header->count = 0;
+  trace.capacity = capacity;
+  trace.position = 0;
+  trace.count = 0;
+}
+
+void traceClose(trace_t &trace) {
+  trace.header->count = trace.count;
+  munmap(trace.header, sizeof(trace_header_t) + trace.capacity * sizeof(trace_record_t));
+  if (trace.count < trace.capacity && ftruncate(trace.fd, sizeof(trace_header_t) + trace.count * sizeof(trace_record_t)) != 0)
+    std::cerr << "Warning: Could not shrink the debug file." << std::endl;
+  close(trace.fd);
+}
+
+/**
+ * @brief prints a record in the format of the old text traces.
+ */
+static void printRecord(const trace_record_t &r) {
+  switch (r.type) {
+    case InstructionType::ADD:
+      printf("[PC %u]: Increased value at %u from %u to %u.\n", r.pc, r.head, r.old_value, r.new_value);
+      break;
+    case InstructionType::SUB:
+      printf("[PC %u]: Decreased value at %u from %u to %u.\n", r.pc, r.head, r.old_value, r.new_value);
+      break;
+    case InstructionType::OUTPUT:
+      printf("[PC %u]: Printing: value at %u = %c.\n", r.pc, r.head, r.new_value);
+      break;
+    case InstructionType::INPUT:
+      printf("[PC %u]: Input char %c at %u\n", r.pc, r.new_value, r.head);
+      break;
+    case InstructionType::INC:
+    case InstructionType::DEC:
+      printf("[PC %u]: Pointer moved to %u.\n", r.pc, r.head);
+      break;
+    case InstructionType::BEQZ:
+      if (r.flags & TRACE_JUMP)
+        printf("[PC %u]: Pointer at %u is zero, skipping the loop.\n", r.pc, r.head);
+      else
+        printf("[PC %u]: Pointer at %u is non-zero, continuing.\n", r.pc, r.head);
+      break;
+    case InstructionType::BNEQ:
+      if (r.flags & TRACE_JUMP)
+        printf("[PC %u]: Pointer at %u is non-zero, jumping back.\n", r.pc, r.head);
+      else
+        printf("[PC %u]: Pointer at %u is zero, continuing.\n", r.pc, r.head);
+      break;
+    default:
+      printf("[PC %u]: Pointer out of the tape at %u.\n", r.pc, r.head);
+      break;
+  }
+}
+
+/**
+ * @brief prints the steps per instruction type, the hottest instructions, the tape range and the output of the records.
+ */
+static void printSummary(const trace_header_t *header, const trace_record_t *records, uint64_t first, uint64_t size) {
+  std::map<uint8_t, uint64_t> types;
+  std::unordered_map<uint32_t, uint64_t> pcs;
+  uint32_t low = UINT32_MAX, high = 0;
+  std::string output;
+  for (uint64_t k = 0; k < size; k++) {
+    const trace_record_t &r = records[(first + k) % header->capacity];
+    types[r.type]++;
+    pcs[r.pc]++;
+    low = std::min(low, r.head);
+    high = std::max(high, r.head);
+    if (r.type == InstructionType::OUTPUT)
+      output += static_cast<char>(r.new_value);
+  }
+  printf("Steps: %lu", header->count);
+  if (size < header->count)
+    printf(", the last %lu recorded", size);
+  printf("\n");
+  for (auto &pair : types)
+    printf("\t%c %12lu\n", pair.first, pair.second);
+  std::vector<std::pair<uint64_t, uint32_t>> hot; // (steps, pc)
+  for (auto &pair : pcs)
+    hot.push_back({pair.second, pair.first});
+  std::sort(hot.begin(), hot.end(), [](auto &a, auto &b){ return a.first > b.first || (a.first == b.first && a.second < b.second); });
+  printf("Hottest instructions:\n");
+  for (size_t k = 0; k < hot.size() && k < 10; k++)
+    printf("\tPC %-10u %12lu\n", hot[k].second, hot[k].first);
+  if (size > 0)
+    printf("Tape used: %u - %u\n", low, high);
+  printf("Output: %s\n", output.c_str());
+}
+
+int traceDecode(int argc, char *argv[]) {
+  std::string file_name;
+  int64_t pc = -1, head = -1;
+  int op = -1;
+  bool summary = false;
+  for (int i = 0; i < argc; i++) {
+    std::string arg = argv[i];
+    if ((arg == "--pc" || arg == "--head" || arg == "--op") && i + 1 < argc) {
+      std::string value = argv[++i];
+      if (arg == "--op")
+        op = static_cast<uint8_t>(value[0]);
+      else
+        (arg == "--pc" ? pc : head) = std::stoll(value);
+    } else if (arg == "--summary") {
+      summary = true;
+    } else if (arg.find("-") == 0 || !file_name.empty()) {
+      std::cerr << "Usage: decode <file.dbg> [--pc n] [--head n] [--op c] [--summary]" << std::endl;
+      return EXIT_FAILURE;
+    } else {
+      file_name = arg;
+    }
+  }
+
+  int fd = open(file_name.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    std::cerr << "Error: Could not open trace file '" << file_name << "'." << std::endl;
+    return EXIT_FAILURE;
+  }
+  size_t size = st.st_size;
+  void *map = size >= sizeof(trace_header_t) ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+  const trace_header_t *header = (const trace_header_t*)map;
+  if (map == MAP_FAILED || memcmp(header->magic, TRACE_MAGIC, 4) != 0 || header->version != TRACE_VERSION ||
+      size < sizeof(trace_header_t) + std::min(header->count, header->capacity) * sizeof(trace_record_t)) {
+    std::cerr << "Error: '" << file_name << "' is not a trace file." << std::endl;
+    return EXIT_FAILURE;
+  }
+  const trace_record_t *records = (const trace_record_t*)(header + 1);
+  // oldest first: once the ring wrapped, the oldest record is the next one that would have been overwritten
+  uint64_t recorded = std::min(header->count, header->capacity);
+  uint64_t first = header->count > header->capacity ? header->count % header->capacity : 0;
+
+  if (summary) {
+    printSummary(header, records, first, recorded);
+  } else {
+    for (uint64_t k = 0; k < recorded; k++) {
+      const trace_record_t &r = records[(first + k) % header->capacity];
+      if ((pc < 0 || r.pc == pc) && (head < 0 || r.head == head) && (op < 0 || r.type == op))
+        printRecord(r);
+    }
+  }
+  munmap(map, size);
+  return EXIT_SUCCESS;
+}
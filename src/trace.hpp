@@ -0,0 +1,77 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <iostream>
+#include <string>
+#include "utils.hpp"
+
+#define TRACE_MAGIC "BFTR"
+#define TRACE_VERSION 1
+#define TRACE_DEFAULT_RECORDS (1 << 24) // Records kept by default, the last ones win once the ring is full
+
+#define TRACE_JUMP 1 // flags of a BEQZ or BNEQ that jumped
+
+/**
+ * @brief one executed instruction, the trace is an array of them.
+ */
+typedef struct{
+  uint32_t pc;        // index of the instruction
+  uint32_t head;      // tape position once the instruction ran
+  uint8_t type;       // InstructionType
+  uint8_t old_value;  // cell at head before the instruction
+  uint8_t new_value;  // cell at head after it, the printed or read char for I/O
+  uint8_t flags;      // TRACE_JUMP
+}trace_record_t;
+
+/**
+ * @brief the start of a trace file, followed by capacity records.
+ * Record n of the run is at n % capacity, so when count > capacity the file holds the last capacity steps.
+ */
+typedef struct{
+  char magic[4];
+  uint32_t version;
+  uint64_t capacity;
+  uint64_t count;     // records written, including the overwritten ones
+}trace_header_t;
+
+/**
+ * @brief a trace being written, the file is mapped and filled in place.
+ */
+typedef struct{
+  int fd;
+  trace_header_t *header;
+  trace_record_t *records;
+  uint64_t capacity;
+  uint64_t position;  // next slot of records
+  uint64_t count;
+}trace_t;
+
+/**
+ * @brief creates file_name with room for capacity records and maps it.
+ * The file is sparse, the pages of the records not written yet take no disk space.
+ */
+void traceOpen(trace_t &trace, const std::string &file_name, uint64_t capacity);
+
+/**
+ * @brief appends a record, overwriting the oldest one when the ring is full.
+ */
+inline void traceRecord(trace_t &trace, uint32_t pc, uint32_t head, uint8_t type, uint8_t old_value, uint8_t new_value, uint8_t flags) {
+  trace.records[trace.position] = {pc, head, type, old_value, new_value, flags};
+  if(++trace.position == trace.capacity)
+    trace.position = 0;
+  trace.count++;
+}
+
+/**
+ * @brief stores the count in the header, unmaps the file and shrinks it to the records written.
+ */
+void traceClose(trace_t &trace);
+
+/**
+ * @brief the decode subcommand: ./bc decode <file.dbg> [--pc n] [--head n] [--op c] [--summary].
+ * Renders the records of a trace as text, oldest first, keeping the ones matching every filter given,
+ * or with --summary prints the steps per instruction type, the hottest instructions, the tape range and the output.
+ * @return the exit status.
+ */
+int traceDecode(int argc, char *argv[]);
+
+#endif
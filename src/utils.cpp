@@ -1,4 +1,8 @@
 #include "utils.hpp"
+#include "passes.hpp"
+#include "trace.hpp"
+#include "lexer.hpp"
+#include "evaluator.hpp"
 
 CompilerArch system_arch;
 
@@ -28,7 +32,21 @@ void getSystemArch(){
     return;
   }
   
-  system_arch = getTargetArch(un.machine); // Get the machine hardware name
+  // Get the machine hardware name, hosts the compiler knows nothing about are left UNKNOWN
+  std::string machine = un.machine;
+  if (machine == "x86_64") {
+    system_arch = CompilerArch::X86_64_A;
+  } else if (machine == "i386" || machine == "i686") {
+    system_arch = CompilerArch::X86_A;
+  } else if (machine.find("armv") == 0) {
+    system_arch = CompilerArch::ARM32_A;
+  } else if (machine == "aarch64" || machine == "arm64") {
+    system_arch = CompilerArch::ARM64_A;
+  } else if (machine.find("riscv") == 0) {
+    system_arch = CompilerArch::RISCV_A;
+  } else {
+    system_arch = CompilerArch::UNKNOWN;
+  }
 }
 
 FILE * fileWrite(const char *filename) {
@@ -67,15 +85,13 @@ ArchitectureInterface * getCompArch(CompilerArch target_arch){
   return NULL;
 }
 
-JITInterface * getJITArch(CompilerArch target_arch){
-  // switch (target_arch) {
-  //   case CompilerArch::X86_A:
-  //     return new X86JIT();
-  //   case CompilerArch::X86_64_A:
-  //     return new X86JIT();
-    
-  // }
-  return NULL;
+JITInterface * getJITArch(CompilerArch target_arch, JIT_init_t *init){
+  switch (target_arch) {
+    case CompilerArch::X86_64_A:
+      return new X86JIT(init);
+    default:
+      return NULL; // no JIT, the interpreter runs the program
+  }
 }
 
 CompilerOptions getCompilerOptions(int argc, char* argv[]) {
@@ -98,6 +114,41 @@ CompilerOptions getCompilerOptions(int argc, char* argv[]) {
       options.debug = true;
     } else if(arg == "--jit" || arg == "-J") {
       options.jit = true;
+    } else if(arg == "--interp" || arg == "-I") {
+      options.interp = true;
+    } else if(arg == "--lazy" || arg == "-L") {
+      options.jit = true;
+      options.lazy = true;
+    } else if(arg == "--profile") {
+      options.jit = true;
+      options.profile = true;
+    } else if(arg == "--profile-out" || arg == "--profile-use") {
+      if (i + 1 < argc) {
+        options.jit = true;
+        if(arg == "--profile-out"){
+          options.profile = true;
+          options.profile_out = argv[++i];
+        }
+        else
+          options.profile_use = argv[++i];
+      } else {
+        std::cerr << "Error: " << arg << " requires a file." << std::endl;
+        exit(EXIT_FAILURE);
+      }
+    } else if(arg == "--perf-map" || arg == "--jitdump") {
+      options.jit = true;
+      options.perf_map = true;
+      options.jitdump |= arg == "--jitdump";
+    } else if(arg == "--perf-counters") {
+      options.jit = true;
+      options.perf_counters = true;
+    } else if(arg == "--stats" || arg == "--stats-json") {
+      options.stats = true;
+      options.stats_json = arg == "--stats-json";
+    } else if(arg == "--tiered" || arg == "-t") {
+      options.tiered = true;
+    } else if(arg == "--elf" || arg == "-E") {
+      options.elf = true;
     } else if(arg == "--verbose" || arg == "-V") {
       options.verbose = true;
     } else if(arg == "--max-cycles" || arg == "-C") {
@@ -107,6 +158,35 @@ CompilerOptions getCompilerOptions(int argc, char* argv[]) {
         std::cerr << "Error: --max-cycles requires a value." << std::endl;
         exit(EXIT_FAILURE);
       }
+    } else if(arg == "--break") {
+      if (i + 1 < argc) {
+        options.breakpoints.insert(std::stoul(argv[++i]));
+        options.debug = true;
+      } else {
+        std::cerr << "Error: --break requires a value." << std::endl;
+        exit(EXIT_FAILURE);
+      }
+    } else if(arg == "--lexer-threads") {
+      if (i + 1 < argc) {
+        options.lexer_threads = std::stoul(argv[++i]);
+      } else {
+        std::cerr << "Error: --lexer-threads requires a value." << std::endl;
+        exit(EXIT_FAILURE);
+      }
+    } else if(arg == "--eval-budget") {
+      if (i + 1 < argc) {
+        options.eval_budget = std::stoll(argv[++i]);
+      } else {
+        std::cerr << "Error: --eval-budget requires a value." << std::endl;
+        exit(EXIT_FAILURE);
+      }
+    } else if(arg == "--trace-size") {
+      if (i + 1 < argc) {
+        options.trace_size = std::stoull(argv[++i]);
+      } else {
+        std::cerr << "Error: --trace-size requires a value." << std::endl;
+        exit(EXIT_FAILURE);
+      }
     } else if(arg == "--max-memory" || arg == "-M") {
       if (i + 1 < argc) {
         options.max_memory = std::stoull(argv[++i]);
@@ -135,17 +215,44 @@ CompilerOptions getCompilerOptions(int argc, char* argv[]) {
         std::cerr << "Error: --name requires a value." << std::endl;
         exit(EXIT_FAILURE);
       }
+    } else if(arg.find("-fno-") == 0) {
+      std::string pass = arg.substr(5);
+      if(!isPass(pass)) {
+        std::cerr << "Error: Unknown pass '" << pass << "'." << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      options.disabled_passes.insert(pass);
     } else if(arg == "--help" || arg == "-h") {
       std::cout << "Usage: " << argv[0] << " [options] <source_file.bf>" << std::endl;
+      std::cout << "       " << argv[0] << " decode <file.dbg> [--pc <n>] [--head <n>] [--op <c>] [--summary]" << std::endl;
       std::cout << "Options:" << std::endl;
       std::cout << "\t-O, --optimize          Disable optimizations" << std::endl;
       std::cout << "\t-J, --jit               Enable Just In Time Compiler" << std::endl;
+      std::cout << "\t-I, --interp            Run with the direct-threaded interpreter, used when the host has no JIT" << std::endl;
+      std::cout << "\t-L, --lazy              JIT compile each top level loop the first time it runs" << std::endl;
+      std::cout << "\t    --profile           JIT with loop counters, the hottest loops are reported on stderr" << std::endl;
+      std::cout << "\t    --profile-out <f>   Like --profile, and save the loop counters to <f>" << std::endl;
+      std::cout << "\t    --profile-use <f>   JIT with the hot loops of <f> aligned and unrolled, and the cold ones kept small" << std::endl;
+      std::cout << "\t-t, --tiered            Interpret and JIT compile only the loops that get hot" << std::endl;
+      std::cout << "\t-E, --elf               Write an x86_64 ELF executable with the JIT code, no assembler needed" << std::endl;
+      std::cout << "\t    --eval-budget <n>   Run the first <n> instructions, up to the first input, at compile time with -J and -E, default " << EVAL_JIT_BUDGET << " and " << EVAL_ELF_BUDGET << ", 0 disables" << std::endl;
       std::cout << "\t-D, --debug             Stop compilation and create a debug file with extended informations about the program" << std::endl;
+      std::cout << "\t    --break <pc>        Run at full speed and start debugging at instruction <pc>, like a # in the source with -D" << std::endl;
+      std::cout << "\t    --trace-size <n>    Keep the last <n> steps in the debug trace, default " << TRACE_DEFAULT_RECORDS << std::endl;
       std::cout << "\t-V, --verbose           Enable verbose output" << std::endl;
+      std::cout << "\t    --lexer-threads <n> Lex sources over " << LEXER_CHUNK_MIN / 1024 << "KB with up to <n> threads, default one per core" << std::endl;
+      std::cout << "\t    --stats             Report phase times, instructions per pass, code size, tape and peak RSS on stderr" << std::endl;
+      std::cout << "\t    --stats-json        Like --stats, as a JSON object" << std::endl;
+      std::cout << "\t    --perf-counters     JIT and report cycles, IPC, mispredicts, cache and iTLB misses of the generated code" << std::endl;
+      std::cout << "\t    --perf-map          JIT and write /tmp/perf-<pid>.map, a symbol for every top level loop for perf report" << std::endl;
+      std::cout << "\t    --jitdump           Like --perf-map, and write the code to /tmp/jit-<pid>.dump for perf inject --jit" << std::endl;
       std::cout << "\t-C, --max-cycles <n>    Set maximum cycles to <n>, default 1000000" << std::endl;
       std::cout << "\t-M, --max-memory <n>    Set maximum memory to <n>, default 3000" << std::endl;
       std::cout << "\t-T, --target-arch <arch>Set target architecture, default detect sys arch" << std::endl;
       std::cout << "\t-N, --name <name>       Set output file name, default source file" << std::endl;
+      std::cout << "\t-fno-<pass>             Disable a single optimization pass:" << std::endl;
+      for(const Pass &pass : passes)
+        std::cout << "\t    " << pass.name << std::string(20 - strlen(pass.name), ' ') << pass.description << std::endl;
       std::cout << "\t-h, --help              Show this help message" << std::endl;
       exit(0);
     }else if(arg.find("--") == 0 || arg.find("-") == 0) {
@@ -163,6 +270,9 @@ CompilerOptions getCompilerOptions(int argc, char* argv[]) {
   if(options.output_file_name.empty()) {
     options.output_file_name = options.source_file_name.substr(0, options.source_file_name.find_last_of('.')) + ".asm";
   }
+  if(options.elf) {
+    options.output_file_name = options.output_file_name.substr(0, options.output_file_name.find_last_of('.')); // executables have no extension
+  }
   if(options.target_arch==CompilerArch::UNKNOWN) {
     getSystemArch();
     options.target_arch = system_arch; // Default detected system architecture
@@ -170,9 +280,15 @@ CompilerOptions getCompilerOptions(int argc, char* argv[]) {
   if(options.max_cycles == 0) {
     options.max_cycles = 1000000; // Default maximum cycles, i kind of not use this option but maybe?
   }
+  if(options.trace_size == 0) {
+    options.trace_size = TRACE_DEFAULT_RECORDS;
+  }
   if(options.max_memory == 0) {
     options.max_memory = 30000; // Default maximum memory size
   }
+  if(options.eval_budget < 0) {
+    options.eval_budget = options.elf ? EVAL_ELF_BUDGET : EVAL_JIT_BUDGET; // an executable pays the evaluation once
+  }
   return options;
 }
 
@@ -4,6 +4,7 @@
 #include <sys/utsname.h>
 #include <cstdint>
 #include <vector>
+#include <set>
 #include "architecture_interface.hpp"
 #include "JIT_arch_iterface.hpp"
 #include "comp_arch/x86.hpp"
@@ -32,6 +33,23 @@ struct CompilerOptions{
   uint64_t max_memory = 0; // Maximum memory flag
   CompilerArch target_arch=CompilerArch::UNKNOWN; // Default target architecture
   bool jit = false; // Just-In-Time compilation flag
+  bool elf = false; // Write an ELF executable with the JIT backend
+  bool interp = false; // Run with the direct-threaded interpreter instead of the JIT
+  bool tiered = false; // Interpret and compile only the hot loops
+  bool lazy = false; // JIT compile each top level loop on its first entry
+  uint64_t trace_size = 0; // Steps kept in the trace of the debugger
+  std::set<uint32_t> breakpoints; // Instructions the debugger stops at, set with --break
+  bool profile = false; // Count loop entries and iterations in the JIT code and report the hottest loops
+  std::string profile_out; // File the loop counters are saved to, set with --profile-out
+  std::string profile_use; // Profile guiding the JIT, set with --profile-use
+  bool stats = false; // Report phase times, instruction counts, code size and peak RSS on stderr
+  bool stats_json = false; // The --stats report as a JSON object
+  bool perf_counters = false; // Read the hardware counters around the JIT code
+  bool perf_map = false; // Write /tmp/perf-<pid>.map naming the JIT code after the source
+  bool jitdump = false; // Also write the JIT code to /tmp/jit-<pid>.dump for perf inject
+  uint32_t lexer_threads = 0; // Threads lexing the source, 0 for one per core
+  int64_t eval_budget = -1; // Instructions the JIT and ELF backends run at compile time, 0 to run none, -1 for the default of the backend
+  std::set<std::string> disabled_passes; // Passes turned off with -fno-<pass>
 };
 typedef struct Compiler_Options Compiler_Options;
 
@@ -48,7 +66,9 @@ void verbose(CompilerOptions options, const std::string &message);
 
 typedef struct{
   InstructionType type;
-  uint32_t extra; // Extra data for the instruction, e.g., times to repeat or branch adress
+  uint8_t arg;    // Small operand of optimized instructions, e.g., the MUL factor
+  int16_t offset; // Cell the instruction works on, relative to the tape pointer (ADD, SUB, MOV0, OUTPUT, INPUT, MUL)
+  uint32_t extra; // Extra data for the instruction, e.g., times to repeat, branch adress or MUL offset
 }Instruction;
 
 
@@ -57,7 +77,7 @@ typedef struct{
 typedef std::vector<Instruction> instructions_list;
 
 ArchitectureInterface * getCompArch(CompilerArch target_arch);
-JITInterface * getJITArch(CompilerArch target_arch);
+JITInterface * getJITArch(CompilerArch target_arch, JIT_init_t *init);
 
 
 CompilerOptions getCompilerOptions(int argc, char* argv[]);